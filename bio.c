@@ -136,7 +136,7 @@ brelse(struct buf *b)
   bcache.head.next = b;
 
   b->flags &= ~B_BUSY;
-  wakeup(b);
+  wakeupone(b);  // only one waiter in bget() can have it
 
   release(&bcache.lock);
 }
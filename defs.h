@@ -2,12 +2,17 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct page;
+struct pagingsave;
 struct pipe;
 struct proc;
 struct rtcdate;
+struct schedstat;
+struct slabcache;
 struct spinlock;
 struct stat;
 struct superblock;
+struct tlbbatch;
 
 // bio.c
 void            binit(void);
@@ -51,12 +56,15 @@ struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
-int				createSwapFile(struct proc* p);
+int             readblocks(struct inode*, char*, uint, uint);
 int				readFromSwapFile(struct proc * p, char* buffer, uint placeOnFile, uint size);
 int				writeToSwapFile(struct proc* p, char* buffer, uint placeOnFile, uint size);
-int				removeSwapFile(struct proc* p);
-int 			writePageToFile(struct proc * p, int pageVaddr, pde_t *pgdir);
-int 			readPageFromFile(struct proc * p, int ramCtrlrIndex, int userPageVAddr, char* buff);
+void			releaseSwapFile(struct proc* p);
+void			swapinit(void);
+void			swapcreate(void);
+int 			writePageToFile(struct proc * p, int pageVaddr, pde_t *pgdir, char *page);
+int 			readPageFromFile(struct proc * p, int userPageVAddr, char* buff);
+int             getFreeSlot(struct proc*);
 void 			copySwapFile(struct proc* fromP, struct proc* toP);
 
 
@@ -76,6 +84,13 @@ char*           kalloc(void);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+char*           kalloc_large(void);
+void            kfree_large(char*);
+char*           kalloc_order(int);
+char*           kalloc_zeroed(void);
+int             kzerofill(void);
+void            kfree_order(char*, int);
+void            kallocstat(void);
 int 			getFreePages();
 int 			getTotalPages();
 
@@ -89,6 +104,7 @@ extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
 void            lapicstartap(uchar, uint);
+void            lapicipi(int, int);
 void            microdelay(int);
 
 // log.c
@@ -97,17 +113,36 @@ void            log_write(struct buf*);
 void            begin_op();
 void            end_op();
 
+// mmap.c
+int             mmap(struct file*, int, int, int, int);
+int             munmap(uint, int);
+int             msync(uint, int);
+void            munmapall(void);
+int             mmapfork(struct proc*);
+int             mmapfault(uint);
+int             mmapevict(pde_t*, uint);
+int             mmapcheck(uint, uint, int);
+
 // mp.c
 extern int      ismp;
 int             mpbcpu(void);
 void            mpinit(void);
 void            mpstartthem(void);
 
+// pcache.c
+void            pcinit(void);
+int             pcread(struct inode*, char*, uint, uint);
+void            pcwrite(struct inode*, char*, uint, uint);
+void            pcinval(struct inode*);
+int             pcreclaim(void);
+void            pcstat(void);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
@@ -119,15 +154,24 @@ struct proc*    copyproc(struct proc*);
 void            exit(void);
 int             fork(void);
 int             growproc(int);
+int             getschedstat(int, int, struct schedstat*);
 int             kill(int);
+void            loadctl(void);
+int             nice(int);
 void            pinit(void);
+void            priboost(void);
 void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
+int             schedtick(void);
+int             setaffinity(int, int);
+int             settickets(int);
+void            suspend(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
+void            wakeupone(void*);
 void            yield(void);
 
 // swtch.S
@@ -137,6 +181,13 @@ void            swtch(struct context**, struct context*);
 struct inode*	create(char *path, short type, short major, short minor);
 int				isdirempty(struct inode *dp);
 
+// slab.c
+void            slabinit(void);
+struct slabcache* slabcreate(char*, uint, void (*)(void*));
+void*           slaballoc(struct slabcache*);
+void            slabfree(void*);
+void            slabstat(void);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
@@ -157,12 +208,23 @@ char*           strncpy(char*, const char*, int);
 
 // syscall.c
 int             argint(int, int*);
-int             argptr(int, char**, int);
+int             argptr(int, char**, int, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
 void            syscall(void);
 
+// tlb.c
+void            tlbbatchinit(struct tlbbatch*, pde_t*);
+void            tlbbatchadd(struct tlbbatch*, pde_t*, uint);
+void            tlbflush(struct tlbbatch*);
+void            tlbinval(pde_t*, uint);
+void            tlbinvalrange(pde_t*, uint, uint);
+void            tlbflushkernel(void);
+void            tlbintr(void);
+void            tlbpoll(void);
+void            tlbstat(void);
+
 // timer.c
 void            timerinit(void);
 
@@ -182,22 +244,39 @@ void            seginit(void);
 void            kvmalloc(void);
 void            vmenable(void);
 pde_t*          setupkvm(void);
+pte_t*          walkpgdir(pde_t*, const void*, int);
+int             mappages(pde_t*, void*, uint, uint, int);
 char*           uva2ka(pde_t*, char*);
 int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
-pde_t*          copyuvm(pde_t*, uint);
+pde_t*          copyuvm(pde_t*, uint, int);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
 int 			pageIsInFile(int vAddr, pde_t *pgdir);
 int 			getPageFromFile(int vAddr);
+int             growstack(uint);
+int             uvmfault(uint);
+int             uvmprefault(uint, uint);
+void            uvmunpin(void);
 void			updateAccessCounters();
 void			printRamCtrlr(); //debugging
 void 			printFileCtrlr();	//debugging
 int             isNONEpolicy();
+int             ramIsFull(void);
+void            addToLRU(pde_t*, uint);
+void            lrudel(struct page*);
+void            copyLRU(struct proc*);
+int             execstage(struct pagingsave*);
+void            execdone(struct pagingsave*);
+void            execunstage(struct pagingsave*);
+void            execswap(struct pagingsave*);
+void            swap(pde_t*, uint);
+void            pageOutAll(void);
+void            removeFromFileCtrlr(uint, pde_t*);
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -12,11 +12,13 @@ exec(char *path, char **argv)
 {
   char *s, *last;
   int i, off;
-  uint argc, sz, sp, ustack[3+MAXARG+1];
+  uint argc, sz, sp, stacklimit, ustack[3+MAXARG+1];
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
   pde_t *pgdir, *oldpgdir;
+  struct pagingsave save;
+  int staged;
 
   begin_op();
   if((ip = namei(path)) == 0){
@@ -25,6 +27,7 @@ exec(char *path, char **argv)
   }
   ilock(ip);
   pgdir = 0;
+  staged = 0;
 
   // Check ELF header
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) < sizeof(elf))
@@ -34,6 +37,9 @@ exec(char *path, char **argv)
 
   if((pgdir = setupkvm()) == 0)
     goto bad;
+  if(execstage(&save) < 0)
+    goto bad;
+  staged = 1;
 
   // Load program into memory.
   sz = 0;
@@ -53,12 +59,18 @@ exec(char *path, char **argv)
   end_op();
   ip = 0;
 
-  // Allocate two pages at the next page boundary.
-  // Make the first inaccessible.  Use the second as the user stack.
+  // Allocate an inaccessible guard page at the next page boundary,
+  // then reserve MAXSTACKPAGES of address space for the user stack.
+  // Only the top stack page is allocated now; the page fault
+  // handler grows the stack down into the rest (see growstack).
   sz = PGROUNDUP(sz);
-  if((sz = allocuvm(pgdir, sz, sz + 2*PGSIZE)) == 0)
+  if((sz = allocuvm(pgdir, sz, sz + PGSIZE)) == 0)
+    goto bad;
+  clearpteu(pgdir, (char*)(sz - PGSIZE));
+  stacklimit = sz;
+  sz += (MAXSTACKPAGES - 1) * PGSIZE;
+  if((sz = allocuvm(pgdir, sz, sz + PGSIZE)) == 0)
     goto bad;
-  clearpteu(pgdir, (char*)(sz - 2*PGSIZE));
   sp = sz;
 
   // Push argument strings, prepare rest of stack in ustack.
@@ -87,14 +99,20 @@ exec(char *path, char **argv)
   safestrcpy(proc->name, last, sizeof(proc->name));
 
   // Commit to the user image.
+  execswap(&save);
+  munmapall();
+  execswap(&save);
 
   oldpgdir = proc->pgdir;
   proc->pgdir = pgdir;
   proc->sz = sz;
+  proc->stackLimit = stacklimit;
+  proc->stackBottom = sz - PGSIZE;
   proc->tf->eip = elf.entry;  // main
   proc->tf->esp = sp;
   switchuvm(proc);
-  freevm(oldpgdir);
+  freevm(oldpgdir);  // the old image's frames leave save.lru
+  execdone(&save);
   return 0;
 
  bad:
@@ -104,5 +122,7 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(staged)
+    execunstage(&save);
   return -1;
 }
@@ -22,9 +22,11 @@ struct inode {
   short nlink;
   uint size;
   uint addrs[NDIRECT+1];
+  struct inode *hnext;  // icache hash chain
 };
 #define I_BUSY 0x1
 #define I_VALID 0x2
+#define I_NOCACHE 0x4  // bypass the page cache (swap files)
 
 // table mapping major device number to
 // device functions
@@ -117,12 +117,12 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, iput() frees if
 //   the link count has fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() to find or
-//   create a cache entry and increment its ref, iput()
-//   to decrement ref.
+// * Referencing in cache: ip->ref tracks the number of
+//   in-memory pointers to a cache entry (open files and
+//   current directories). iget() to find or create a cache
+//   entry and increment its ref, iput() to decrement ref.
+//   Entries are allocated from a slab cache and freed when
+//   ref falls to zero, so there is no fixed limit on them.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when the I_VALID bit
@@ -154,15 +154,19 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 
+#define IHASH 64
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct slabcache *cache;
+  struct inode *hash[IHASH];  // inodes with ref > 0
 } icache;
 
 void
 iinit(int dev)
 {
   initlock(&icache.lock, "icache");
+  icache.cache = slabcreate("inode", sizeof(struct inode), 0);
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d inodestart %d bmap start %d\n", sb.size,
           sb.nblocks, sb.ninodes, sb.nlog, sb.logstart, sb.inodestart, sb.bmapstart);
@@ -218,33 +222,49 @@ iupdate(struct inode *ip)
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
 static struct inode*
-iget(uint dev, uint inum)
+icachelookup(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
-  acquire(&icache.lock);
+  for(ip = icache.hash[(dev + inum) % IHASH]; ip; ip = ip->hnext)
+    if(ip->dev == dev && ip->inum == inum)
+      return ip;
+  return 0;
+}
+
+static struct inode*
+iget(uint dev, uint inum)
+{
+  struct inode *ip, *new;
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&icache.lock);
-      return ip;
-    }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
+  acquire(&icache.lock);
+  if((ip = icachelookup(dev, inum)) != 0){
+    ip->ref++;
+    release(&icache.lock);
+    return ip;
   }
+  release(&icache.lock);
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
+  // Allocate a cache entry, outside the lock since the slab
+  // allocator may need to reclaim memory.
+  if((new = slaballoc(icache.cache)) == 0)
     panic("iget: no inodes");
-
-  ip = empty;
+  acquire(&icache.lock);
+  if((ip = icachelookup(dev, inum)) != 0){
+    // Someone else cached it meanwhile.
+    ip->ref++;
+    release(&icache.lock);
+    slabfree(new);
+    return ip;
+  }
+  ip = new;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->flags = 0;
+  ip->hnext = icache.hash[(dev + inum) % IHASH];
+  icache.hash[(dev + inum) % IHASH] = ip;
   release(&icache.lock);
 
   return ip;
@@ -308,8 +328,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode cache entry can
-// be recycled.
+// If that was the last reference, the inode cache entry is
+// freed.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -317,6 +337,8 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
+  struct inode **pp;
+
   acquire(&icache.lock);
   if(ip->ref == 1 && (ip->flags & I_VALID) && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
@@ -331,8 +353,18 @@ iput(struct inode *ip)
     ip->flags = 0;
     wakeup(ip);
   }
-  ip->ref--;
+  if(--ip->ref > 0){
+    release(&icache.lock);
+    return;
+  }
+  for(pp = &icache.hash[(ip->dev + ip->inum) % IHASH]; *pp; pp = &(*pp)->hnext){
+    if(*pp == ip){
+      *pp = ip->hnext;
+      break;
+    }
+  }
   release(&icache.lock);
+  slabfree(ip);
 }
 
 // Common idiom: unlock, then put.
@@ -395,6 +427,7 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  pcinval(ip);
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -434,9 +467,6 @@ stati(struct inode *ip, struct stat *st)
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
-  uint tot, m;
-  struct buf *bp;
-
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
       return -1;
@@ -448,6 +478,19 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  if(ip->type == T_FILE && !(ip->flags & I_NOCACHE))
+    return pcread(ip, dst, off, n);
+  return readblocks(ip, dst, off, n);
+}
+
+// Read data from inode through the buffer cache, bypassing
+// the page cache.  off and n must lie within the file.
+int
+readblocks(struct inode *ip, char *dst, uint off, uint n)
+{
+  uint tot, m;
+  struct buf *bp;
+
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
@@ -484,6 +527,9 @@ writei(struct inode *ip, char *src, uint off, uint n)
     brelse(bp);
   }
 
+  if(ip->type == T_FILE && !(ip->flags & I_NOCACHE))
+    pcwrite(ip, src - n, off - n, n);
+
   if(n > 0 && off > ip->size){
     ip->size = off;
     iupdate(ip);
@@ -672,80 +718,126 @@ char* itoa(int i, char b[]){
     }while(i);
     return b;
 }
-//remove swap file of proc p;
-int removeSwapFile(struct proc* p){
-	//path of proccess
-	char path[DIGITS];
-	memmove(path,"/.swap", 6);
-	itoa(p->pid, path+ 6);
-
-	struct inode *ip, *dp;
-	struct dirent de;
-	char name[DIRSIZ];
-	uint off;
-
-	if(0 == p->swapFile)
-	{
-		return -1;
-	}
-	fileclose(p->swapFile);
-
-	begin_op();
-	if((dp = nameiparent(path, name)) == 0)
-	{
-		end_op();
-		return -1;
-	}
+// Swap files are pooled.  A process gets one from swappool the first
+// time it pages out, and gives it back on exit, when the file is
+// truncated so that its blocks return to the file system.  A process
+// that never swaps does no swap file I/O.  The NSWAPFILE pool files
+// /.swapN are created empty (or found, after a reboot) by the first
+// process, so that handing one out on the eviction path, which may
+// run inside a transaction, needs no file system update.  A process
+// that finds every file in use waits for one to be released.
+struct {
+  struct spinlock lock;
+  struct file *file[NSWAPFILE];
+  int inuse[NSWAPFILE];
+} swappool;
 
-	ilock(dp);
+void
+swapinit(void)
+{
+  initlock(&swappool.lock, "swappool");
+}
 
-	  // Cannot unlink "." or "..".
-	if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0)
-	   goto bad;
+static struct file*
+createSwapFile(int n)
+{
+	struct file *f;
+	char path[DIGITS];
+	memmove(path,"/.swap", 6);
+	itoa(n, path+ 6);
 
-	if((ip = dirlookup(dp, name, &off)) == 0)
-		goto bad;
-	ilock(ip);
+  begin_op();
+  struct inode * in = create(path, T_FILE, 0, 0);
+  if(in == 0)
+    panic("createSwapFile");
+  in->flags |= I_NOCACHE; //swapped pages must not also fill the page cache
+  if(in->size > 0) //left over from before a crash
+    itrunc(in);
+	iunlock(in);
+  end_op();
 
-	if(ip->nlink < 1)
-		panic("unlink: nlink < 1");
-	if(ip->type == T_DIR && !isdirempty(ip)){
-		iunlockput(ip);
-		goto bad;
-	}
+	f = filealloc();
+	if (f == 0)
+	 panic("no slot for files on /store");
+	f->ip = in;
+	f->type = FD_INODE;
+	f->off = 0;
+	f->readable = O_WRONLY;
+	f->writable = O_RDWR;
+  return f;
+}
 
-	memset(&de, 0, sizeof(de));
-	if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-		panic("unlink: writei");
-	if(ip->type == T_DIR){
-		dp->nlink--;
-		iupdate(dp);
-	}
-	iunlockput(dp);
+// Fill the pool.  Called once by the first process, after the file
+// system is initialized.
+void
+swapcreate(void)
+{
+  int i;
 
-	ip->nlink--;
-	iupdate(ip);
-	iunlockput(ip);
+  for(i = 0; i < NSWAPFILE; i++)
+    swappool.file[i] = createSwapFile(i);
+}
 
-	end_op();
+// Give p a swap file from the pool if it has none.
+static void
+getSwapFile(struct proc *p)
+{
+  int i;
 
-	return 0;
+  if(p->swapFile)
+    return;
+  acquire(&swappool.lock);
+  for(;;){
+    for(i = 0; i < NSWAPFILE; i++)
+      if(!swappool.inuse[i])
+        break;
+    if(i < NSWAPFILE)
+      break;
+    sleep(&swappool, &swappool.lock);
+  }
+  swappool.inuse[i] = 1;
+  release(&swappool.lock);
+  p->swapFile = swappool.file[i];
+}
 
-	bad:
-		iunlockput(dp);
-		end_op();
-		return -1;
+// Return the swap file of p, if any, to the pool, truncated.
+// Called by exit(), outside any transaction.
+void
+releaseSwapFile(struct proc *p)
+{
+  struct inode *ip;
+  int i;
 
+  if(p->swapFile == 0)
+    return;
+  ip = p->swapFile->ip;
+  if(ip->size > 0){ //only p writes the file, so size is stable
+    begin_op();
+    ilock(ip);
+    itrunc(ip);
+    iunlock(ip);
+    end_op();
+  }
+  acquire(&swappool.lock);
+  for(i = 0; i < NSWAPFILE; i++)
+    if(swappool.file[i] == p->swapFile)
+      swappool.inuse[i] = 0;
+  wakeup(&swappool);
+  release(&swappool.lock);
+  p->swapFile = 0;
 }
 
 //return as sys_read (-1 when error)
 int readFromSwapFile(struct proc * p, char* buffer, uint placeOnFile, uint size){
+  if(p->swapFile == 0)
+    return -1;
   p->swapFile->off = placeOnFile;
   return fileread(p->swapFile, buffer,  size);
 }
 
 //return as sys_write (-1 when error)
 int writeToSwapFile(struct proc * p, char* buffer, uint placeOnFile, uint size){
+  getSwapFile(p);
   p->swapFile->off = placeOnFile;
   return filewrite(p->swapFile, buffer, size);
 }
@@ -760,9 +852,13 @@ int getFreeSlot(struct proc * p) {
   return -1; //file is full
 }
 
-int writePageToFile(struct proc * p, int userPageVAddr, pde_t *pgdir) {
+//page is the kernel address of the frame, which need not be mapped
+//in the current address space (see exec)
+int writePageToFile(struct proc * p, int userPageVAddr, pde_t *pgdir, char *page) {
   int freePlace = getFreeSlot(p);
-  int retInt = writeToSwapFile(p, (char*)userPageVAddr, PGSIZE*freePlace, PGSIZE);
+  if (freePlace < 0) //proc->npages keeps a slot free for every eviction
+    panic("writePageToFile: swap file full");
+  int retInt = writeToSwapFile(p, page, PGSIZE*freePlace, PGSIZE);
   if (retInt == -1)
     return -1;
   //if reached here - data was successfully placed in file
@@ -774,17 +870,22 @@ int writePageToFile(struct proc * p, int userPageVAddr, pde_t *pgdir) {
   return retInt;
 }
 
-int readPageFromFile(struct proc * p, int ramCtrlrIndex, int userPageVAddr, char* buff) {
+int readPageFromFile(struct proc * p, int userPageVAddr, char* buff) {
   int maxStructCount = (MAX_TOTAL_PAGES - MAX_PYSC_PAGES);
   int i;
   int retInt;
   for (i = 0; i < maxStructCount; i++) {
-    if (p->fileCtrlr[i].userPageVAddr == userPageVAddr) {
+    if (p->fileCtrlr[i].state == USED && p->fileCtrlr[i].userPageVAddr == userPageVAddr) {
+      if (p->fileCtrlr[i].mem){ //set aside by exec (see execstage)
+        memmove(buff, p->fileCtrlr[i].mem, PGSIZE);
+        kfree(p->fileCtrlr[i].mem);
+        p->fileCtrlr[i].mem = 0;
+        p->fileCtrlr[i].state = NOTUSED;
+        return PGSIZE;
+      }
       retInt = readFromSwapFile(p, buff, i*PGSIZE, PGSIZE);
       if (retInt == -1)
         break; //error in read
-      p->ramCtrlr[ramCtrlrIndex] = p->fileCtrlr[i];
-      p->ramCtrlr[ramCtrlrIndex].loadOrder = proc->loadOrderCounter++;
       p->fileCtrlr[i].state = NOTUSED;
       return retInt;
     }
@@ -793,29 +894,6 @@ int readPageFromFile(struct proc * p, int ramCtrlrIndex, int userPageVAddr, char
   return -1;
 }
 
-//return 0 on success
-int createSwapFile(struct proc* p){
-
-	char path[DIGITS];
-	memmove(path,"/.swap", 6);
-	itoa(p->pid, path+ 6);
-
-  begin_op();
-  struct inode * in = create(path, T_FILE, 0, 0);
-	iunlock(in);
-
-	p->swapFile = filealloc();
-	if (p->swapFile == 0)
-	 panic("no slot for files on /store");
-	p->swapFile->ip = in;
-	p->swapFile->type = FD_INODE;
-	p->swapFile->off = 0;
-	p->swapFile->readable = O_WRONLY;
-	p->swapFile->writable = O_RDWR;
-  end_op();
-  return 0;
-}
-
 void copySwapFile(struct proc* fromP, struct proc* toP){
   if (fromP->pid < 3)
     return;
@@ -1,6 +1,23 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, and physically
+// contiguous, naturally aligned blocks of 2^order pages up to 4MB.
+//
+// Free memory is kept by a binary buddy allocator: one free list
+// per order, and a block of order k at physical address pa has its
+// buddy at pa ^ (PGSIZE << k).  Freeing a block merges it with its
+// buddy as long as the buddy is free too.  kmem.order[] records,
+// for the first page of every free block, its order plus one.
+//
+// Each CPU keeps a small magazine of free pages that it allocates
+// from and frees to with only interrupts disabled.  An empty
+// magazine is refilled, and a full one drained, KMAGBATCH pages at
+// a time from the buddy allocator under kmem.lock.
+//
+// The idle loop keeps up to ZPOOLSIZE free pages zeroed ahead of
+// time (kzerofill), so kalloc_zeroed() usually need not clear a
+// page.  Freed pages are filled with junk only in KDEBUG kernels
+// (KMODE in the Makefile).
 
 #include "types.h"
 #include "defs.h"
@@ -8,23 +25,162 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "proc.h"
+#include "page.h"
+
+#define MAXORDER LARGEPGORDER  // largest block: one 4MB page
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
-static int freePages = 0;
 
 struct run {
   struct run *next;
+  struct run *prev;
 };
 
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run *free[MAXORDER+1];   // free blocks of each order
+  int nfree[MAXORDER+1];          // length of each free list
+  uchar order[PHYSTOP/PGSIZE];    // order+1 of a free block's first page
+  struct run *zlist;              // pre-zeroed pages
+  int nzero;                      // length of zlist
 } kmem;
 
+//PAGEBREAK!
+// Buddy allocator.  Caller holds kmem.lock.
+
+static void
+bpush(struct run *r, int order)
+{
+  r->prev = 0;
+  r->next = kmem.free[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.free[order] = r;
+  kmem.nfree[order]++;
+  kmem.order[v2p(r)/PGSIZE] = order + 1;
+}
+
+static void
+bunlink(struct run *r, int order)
+{
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.free[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.nfree[order]--;
+  kmem.order[v2p(r)/PGSIZE] = 0;
+}
+
+// Free the block of 2^order pages at v, merging it with free buddies.
+static void
+bfree(char *v, int order)
+{
+  uint pa, bpa;
+
+  pa = v2p(v);
+  for(; order < MAXORDER; order++){
+    bpa = pa ^ (PGSIZE << order);
+    if(bpa + (PGSIZE << order) > PHYSTOP || kmem.order[bpa/PGSIZE] != order + 1)
+      break;
+    bunlink((struct run*)p2v(bpa), order);
+    pa &= ~(PGSIZE << order);
+  }
+  bpush((struct run*)p2v(pa), order);
+}
+
+// Allocate a block of 2^order pages, splitting a larger one if needed.
+static char*
+balloc(int order)
+{
+  struct run *r;
+  int k;
+
+  for(k = order; k <= MAXORDER && kmem.free[k] == 0; k++)
+    ;
+  if(k > MAXORDER)
+    return 0;
+  r = kmem.free[k];
+  bunlink(r, k);
+  while(k > order){
+    k--;
+    bpush((struct run*)((char*)r + (PGSIZE << k)), k);
+  }
+  return (char*)r;
+}
+
+// Per-CPU magazines, indexed like cpus[].  Only touched by their
+// own CPU with interrupts off.
+static struct kmag {
+  struct run *list;
+  int n;
+} mag[NCPU];
+
+// Give KMAGBATCH pages of magazine m back to the buddy allocator.
+static void
+kmagdrain(struct kmag *m)
+{
+  struct run *r;
+  int i;
+
+  acquire(&kmem.lock);
+  for(i = 0; i < KMAGBATCH && m->list; i++){
+    r = m->list;
+    m->list = r->next;
+    m->n--;
+    bfree((char*)r, 0);
+  }
+  release(&kmem.lock);
+}
+
+// Move up to KMAGBATCH pages from the buddy allocator to
+// magazine m.
+static void
+kmagfill(struct kmag *m)
+{
+  struct run *r;
+  int i;
+
+  acquire(&kmem.lock);
+  for(i = 0; i < KMAGBATCH && (r = (struct run*)balloc(0)) != 0; i++){
+    r->next = m->list;
+    m->list = r;
+    m->n++;
+  }
+  release(&kmem.lock);
+}
+
+struct page pages[PHYSTOP/PGSIZE];
+
+// Set up the descriptor of a newly allocated frame.
+static char*
+pginit(char *v)
+{
+  struct page *pg;
+
+  if(v){
+    pg = pa2page(v2p(v));
+    pg->ref = 1;
+    pg->flags = 0;
+  }
+  return v;
+}
+
+// Free pages in the system: the buddy free lists plus every
+// magazine.  Each count is exact; the sum is a snapshot.
 int getFreePages(){
-  return freePages;
+  int i, n;
+
+  n = kmem.nzero;
+  for(i = 0; i <= MAXORDER; i++)
+    n += kmem.nfree[i] << i;
+  for(i = 0; i < NCPU; i++)
+    n += mag[i].n;
+  return n;
 }
 
 int getTotalPages(){
@@ -70,35 +226,199 @@ void
 kfree(char *v)
 {
   struct run *r;
+  struct kmag *m;
+  struct page *pg;
 
   if((uint)v % PGSIZE || v < end || v2p(v) >= PHYSTOP)
     panic("kfree");
-  freePages++;
+  pg = pa2page(v2p(v));
+  if(pg->ref > 1){
+    pg->ref--;
+    return;
+  }
+  if(pg->lru)
+    lrudel(pg);
+  pg->ref = 0;
+  pg->flags = 0;
+#if KDEBUG
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
+
+  if(!kmem.use_lock){
+    // Boot: one CPU, and no per-CPU state yet.
+    bfree(v, 0);
+    return;
+  }
+  r = (struct run*)v;
+  pushcli();
+  m = &mag[cpu - cpus];
+  r->next = m->list;
+  m->list = r;
+  if(++m->n > KMAGSIZE)
+    kmagdrain(m);
+  popcli();
+}
+
+// Free the block of 2^order pages at v, which must have been
+// returned by kalloc_order(order).
+void
+kfree_order(char *v, int order)
+{
+  if(order < 0 || order > MAXORDER || (uint)v % (PGSIZE << order)
+     || v < end || v2p(v) + (PGSIZE << order) > PHYSTOP)
+    panic("kfree_order");
+  pa2page(v2p(v))->ref = 0;
+#if KDEBUG
+  // Fill with junk to catch dangling refs.
+  memset(v, 1, PGSIZE << order);
+#endif
 
   if(kmem.use_lock)
     acquire(&kmem.lock);
-  r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  bfree(v, order);
   if(kmem.use_lock)
     release(&kmem.lock);
 }
 
-// Allocate one 4096-byte page of physical memory.
-// Returns a pointer that the kernel can use.
-// Returns 0 if the memory cannot be allocated.
-char* kalloc(void){
-  struct run *r;
+// Allocate 2^order physically contiguous pages, aligned to
+// their size.  Returns 0 if no such block is free.
+char*
+kalloc_order(int order)
+{
+  char *v;
+
+  if(order < 0 || order > MAXORDER)
+    return 0;
   if(kmem.use_lock)
     acquire(&kmem.lock);
-  freePages--;
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+  v = balloc(order);
   if(kmem.use_lock)
     release(&kmem.lock);
+  return pginit(v);
+}
+
+// Free a 4MB frame returned by kalloc_large().
+void
+kfree_large(char *v)
+{
+  kfree_order(v, LARGEPGORDER);
+}
+
+// Allocate one physically contiguous, 4MB-aligned frame.
+// Returns 0 if none is left.
+char*
+kalloc_large(void)
+{
+  return kalloc_order(LARGEPGORDER);
+}
+
+// Print the number of free blocks of each order.  For procdump.
+void
+kallocstat(void)
+{
+  int i;
+
+  cprintf("free blocks by order:");
+  for(i = 0; i <= MAXORDER; i++)
+    cprintf(" %d", kmem.nfree[i]);
+  cprintf("\n");
+}
+
+// Take a page from this CPU's magazine, refilling it if empty.
+static char*
+kmagalloc(void)
+{
+  struct run *r;
+  struct kmag *m;
+
+  pushcli();
+  m = &mag[cpu - cpus];
+  if(m->n == 0)
+    kmagfill(m);
+  r = m->list;
+  if(r){
+    m->list = r->next;
+    m->n--;
+  }
+  popcli();
   return (char*)r;
 }
 
+// Take a page from the pre-zeroed pool, or return 0.
+// An empty pool is noticed without kmem.lock, so that the
+// single-page paths do not take it whenever the idle loop has
+// not kept up.
+static char*
+kzeroalloc(void)
+{
+  struct run *r;
+
+  if(kmem.nzero == 0)
+    return 0;
+  acquire(&kmem.lock);
+  r = kmem.zlist;
+  if(r){
+    kmem.zlist = r->next;
+    kmem.nzero--;
+  }
+  release(&kmem.lock);
+  if(r)
+    memset(r, 0, sizeof(*r));  // the list link was the only non-zero data
+  return (char*)r;
+}
+
+// Allocate one 4096-byte page of physical memory.
+// Returns a pointer that the kernel can use.
+// Returns 0 if the memory cannot be allocated.
+// When memory runs out, pages are taken from the pre-zeroed pool
+// and then back from the page cache.
+// Pages sitting in other CPUs' magazines (at most KMAGSIZE each)
+// are not reclaimed.
+char* kalloc(void){
+  char *v;
+
+  if(!kmem.use_lock)
+    return pginit(balloc(0));
+again:
+  if((v = kmagalloc()) == 0)
+    v = kzeroalloc();
+  if(!v && pcreclaim())
+    goto again;
+  return pginit(v);
+}
+
+// Allocate one page of physical memory filled with zeros.
+// Returns 0 if the memory cannot be allocated.
+char*
+kalloc_zeroed(void)
+{
+  char *v;
+
+  if(kmem.use_lock && (v = kzeroalloc()) != 0)
+    return pginit(v);
+  if((v = kalloc()) != 0)
+    memset(v, 0, PGSIZE);
+  return v;
+}
+
+// Zero one free page into the pre-zeroed pool, if it is not full.
+// Called by the scheduler when it has nothing to run.
+// Returns 1 if a page was added.
+int
+kzerofill(void)
+{
+  struct run *r;
+
+  if(kmem.nzero >= ZPOOLSIZE)
+    return 0;
+  if((r = (struct run*)kmagalloc()) == 0)
+    return 0;
+  memset(r, 0, PGSIZE);
+  acquire(&kmem.lock);
+  r->next = kmem.zlist;
+  kmem.zlist = r;
+  kmem.nzero++;
+  release(&kmem.lock);
+  return 1;
+}
@@ -30,7 +30,11 @@ main(void)
   pinit();         // process table
   tvinit();        // trap vectors
   binit();         // buffer cache
+  slabinit();      // small object allocator
+  pcinit();        // page cache
   fileinit();      // file table
+  swapinit();      // swap file pool
+  pipeinit();      // pipes
   ideinit();       // disk
   if(!ismp)
     timerinit();   // uniprocessor timer
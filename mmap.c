@@ -0,0 +1,379 @@
+//
+// Memory-mapped files.
+//
+// mmap() only records a region in proc->mmaps; no memory is
+// allocated until the process touches a page.  The page fault
+// handler then reads the page straight from the inode into a
+// fresh frame (mmapfault).  Resident mapped pages take part in
+// the normal page replacement (they are on the process's LRU
+// list like any other page, and count against MAX_TOTAL_PAGES), but
+// when a clean one is chosen as a victim, mmapevict() drops it
+// instead of writing it to the swap file: it can be read again from
+// the inode.  Dirty pages go to the swap file.  Dirty MAP_SHARED
+// pages reach their file only in msync() and munmap() (or exit and
+// exec), never on the eviction path: that may run inside a file
+// system transaction, even one that holds the mapped inode's lock.
+//
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "stat.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "x86.h"
+
+// Return the region of p that contains va, or 0.
+static struct mmapregion*
+findregion(struct proc *p, uint va)
+{
+  struct mmapregion *r;
+
+  for(r = p->mmaps; r < &p->mmaps[NMMAP]; r++)
+    if(r->f && va >= r->addr && va < r->addr + r->len)
+      return r;
+  return 0;
+}
+
+// Find a free range of len bytes between MMAPBASE and KERNBASE.
+static uint
+findaddr(struct proc *p, uint len)
+{
+  struct mmapregion *r;
+  uint a;
+
+  a = MMAPBASE;
+again:
+  if(a + len > KERNBASE || a + len < a)
+    return 0;
+  for(r = p->mmaps; r < &p->mmaps[NMMAP]; r++){
+    if(r->f && a < r->addr + r->len && r->addr < a + len){
+      a = r->addr + r->len;
+      goto again;
+    }
+  }
+  return a;
+}
+
+// Copy the page at kernel address mem back to the file
+// offset that backs user address a.  Never extends the file.
+static void
+writeback(struct mmapregion *r, uint a, char *mem)
+{
+  struct inode *ip;
+  uint off, n;
+
+  ip = r->f->ip;
+  off = r->off + (a - r->addr);
+  begin_op();
+  ilock(ip);
+  if(off < ip->size){
+    n = ip->size - off;
+    if(n > PGSIZE)
+      n = PGSIZE;
+    writei(ip, mem, off, n);
+  }
+  iunlock(ip);
+  end_op();
+}
+
+// Map len bytes of file f, starting at page-aligned offset off,
+// into the current process.  Returns the address of the mapping
+// or -1 on error.
+int
+mmap(struct file *f, int len, int prot, int flags, int off)
+{
+  struct mmapregion *r, *free;
+  uint addr;
+  int type;
+
+  if(len <= 0 || off < 0 || off % PGSIZE != 0)
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if(f->type != FD_INODE || !f->readable)
+    return -1;
+  if(flags == MAP_SHARED && (prot & PROT_WRITE) && !f->writable)
+    return -1;
+  ilock(f->ip);
+  type = f->ip->type;
+  iunlock(f->ip);
+  if(type != T_FILE)
+    return -1;
+
+  free = 0;
+  for(r = proc->mmaps; r < &proc->mmaps[NMMAP]; r++){
+    if(r->f == 0){
+      free = r;
+      break;
+    }
+  }
+  if(free == 0)
+    return -1;
+  len = PGROUNDUP(len);
+  if((addr = findaddr(proc, len)) == 0)
+    return -1;
+
+  free->f = filedup(f);
+  free->addr = addr;
+  free->len = len;
+  free->off = off;
+  free->prot = prot;
+  free->flags = flags;
+  return addr;
+}
+
+// Write every dirty resident page of the MAP_SHARED regions
+// overlapping [addr, addr+len) back to its file.
+int
+msync(uint addr, int len)
+{
+  struct mmapregion *r;
+  pte_t *pte;
+  uint a, last;
+
+  if(len <= 0 || addr % PGSIZE != 0)
+    return -1;
+  last = addr + PGROUNDUP(len);
+  for(a = addr; a < last; a += PGSIZE){
+    if((r = findregion(proc, a)) == 0)
+      return -1;
+    if(r->flags != MAP_SHARED)
+      continue;
+    pte = walkpgdir(proc->pgdir, (char*)a, 0);
+    if(pte && (*pte & PTE_PG) && !getPageFromFile(a))
+      return -1;
+    if(pte && (*pte & PTE_P) && (*pte & PTE_D)){
+      writeback(r, a, p2v(PTE_ADDR(*pte)));
+      *pte &= ~PTE_D;
+      tlbinval(proc->pgdir, a); // so the next write sets PTE_D again
+    }
+  }
+  return 0;
+}
+
+// Remove the pages [a, last) of region r from the current process,
+// writing dirty shared pages back to the file first.  Paged-out
+// pages are all dirty (see mmapevict).
+static void
+unmappages(struct mmapregion *r, uint start, uint last)
+{
+  pte_t *pte;
+  char *mem;
+  uint a;
+
+  for(a = start; a < last; a += PGSIZE){
+    pte = walkpgdir(proc->pgdir, (char*)a, 0);
+    if(pte == 0 || (*pte & (PTE_P|PTE_PG)) == 0)
+      continue;
+    if(*pte & PTE_P){
+      if(r->flags == MAP_SHARED && (*pte & PTE_D))
+        writeback(r, a, p2v(PTE_ADDR(*pte)));
+      kfree(p2v(PTE_ADDR(*pte)));
+    } else if(r->flags == MAP_SHARED && (mem = kalloc()) != 0){
+      if(readPageFromFile(proc, a, mem) == PGSIZE)
+        writeback(r, a, mem);
+      kfree(mem);
+    } else
+      removeFromFileCtrlr(a, proc->pgdir);
+    *pte = 0;
+    proc->npages--;
+  }
+  tlbinvalrange(proc->pgdir, start, last);
+}
+
+// Unmap [addr, addr+len).  The range must lie inside a single
+// region and must not split it in two.
+int
+munmap(uint addr, int len)
+{
+  struct mmapregion *r;
+  uint last;
+
+  if(len <= 0 || addr % PGSIZE != 0)
+    return -1;
+  if((r = findregion(proc, addr)) == 0)
+    return -1;
+  last = addr + PGROUNDUP(len);
+  if(last > r->addr + r->len)
+    return -1;
+  if(addr != r->addr && last != r->addr + r->len)
+    return -1;
+
+  unmappages(r, addr, last);
+  if(addr == r->addr && last == r->addr + r->len){
+    fileclose(r->f);
+    r->f = 0;
+  } else if(addr == r->addr){
+    r->off += last - addr;
+    r->addr = last;
+    r->len -= last - addr;
+  } else
+    r->len = addr - r->addr;
+  return 0;
+}
+
+// Unmap every region of the current process.  Called by
+// exit() and by exec() when the old image is discarded (with the
+// old image's paging state, see execswap).
+void
+munmapall(void)
+{
+  struct mmapregion *r;
+
+  for(r = proc->mmaps; r < &proc->mmaps[NMMAP]; r++){
+    if(r->f){
+      unmappages(r, r->addr, r->addr + r->len);
+      fileclose(r->f);
+      r->f = 0;
+    }
+  }
+}
+
+// Give the fork child np its own copy of the parent's regions.
+// Resident pages are copied and paged-out pages keep their
+// PTE_PG entries (copySwapFile copies their contents).
+// Returns 0 on success, -1 if out of memory; on failure np's
+// regions are released but the caller must free np->pgdir.
+int
+mmapfork(struct proc *np)
+{
+  struct mmapregion *r;
+  pte_t *pte, *npte;
+  char *mem;
+  uint a;
+  int i;
+
+  for(i = 0; i < NMMAP; i++){
+    r = &proc->mmaps[i];
+    if(r->f == 0)
+      continue;
+    np->mmaps[i] = *r;
+    filedup(r->f);
+    for(a = r->addr; a < r->addr + r->len; a += PGSIZE){
+      pte = walkpgdir(proc->pgdir, (char*)a, 0);
+      if(pte == 0 || (*pte & (PTE_P|PTE_PG)) == 0)
+        continue;
+      if((npte = walkpgdir(np->pgdir, (char*)a, 1)) == 0)
+        goto bad;
+      if(*pte & PTE_PG){
+        *npte = PTE_FLAGS(*pte);
+        continue;
+      }
+      if((mem = kalloc()) == 0)
+        goto bad;
+      memmove(mem, p2v(PTE_ADDR(*pte)), PGSIZE);
+      *npte = v2p(mem) | PTE_FLAGS(*pte);
+    }
+  }
+  return 0;
+
+bad:
+  // The pages already copied are freed with np->pgdir.
+  for(r = np->mmaps; r < &np->mmaps[NMMAP]; r++){
+    if(r->f){
+      fileclose(r->f);
+      r->f = 0;
+    }
+  }
+  return -1;
+}
+
+// Handle a page fault at va in a mapped region by reading
+// the page from the file.  Returns 1 if the fault was handled.
+int
+mmapfault(uint va)
+{
+  struct mmapregion *r;
+  struct inode *ip;
+  pte_t *pte;
+  char *mem;
+  uint a, off, n;
+  int perm;
+
+  if(va >= KERNBASE || (r = findregion(proc, va)) == 0)
+    return 0;
+  a = PGROUNDDOWN(va);
+  pte = walkpgdir(proc->pgdir, (char*)a, 0);
+  if(pte && (*pte & (PTE_P|PTE_PG)))
+    return 0; // protection fault, or paged out (see getPageFromFile)
+  if(!isNONEpolicy() && proc->pid > 2 && proc->npages >= MAX_TOTAL_PAGES){
+    cprintf("proc is too big\n");
+    return 0;
+  }
+  if((mem = kalloc_zeroed()) == 0)
+    return 0;
+
+  ip = r->f->ip;
+  off = r->off + (a - r->addr);
+  ilock(ip);
+  if(off < ip->size){
+    n = ip->size - off;
+    if(n > PGSIZE)
+      n = PGSIZE;
+    readi(ip, mem, off, n);
+  }
+  iunlock(ip);
+
+  perm = PTE_U;
+  if(r->prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(mappages(proc->pgdir, (char*)a, PGSIZE, v2p(mem), perm) < 0){
+    kfree(mem);
+    return 0;
+  }
+  proc->faultCounter++;
+  proc->npages++;
+  if(!isNONEpolicy() && proc->pid > 2){
+    if(ramIsFull())
+      swap(proc->pgdir, a);
+    else
+      addToLRU(proc->pgdir, a);
+  }
+  return 1;
+}
+
+// Called when the page replacement policy picks the resident page
+// at va as a victim.  If it is a clean file-backed page, unmap it
+// and return 1; the caller frees the frame.  A dirty page goes to
+// the swap file like an anonymous one, shared or not: writing it
+// back here would need a transaction and the inode lock, which the
+// faulting process may already hold.
+int
+mmapevict(pde_t *pgdir, uint va)
+{
+  struct mmapregion *r;
+  pte_t *pte;
+
+  if(proc == 0 || pgdir != proc->pgdir || (r = findregion(proc, va)) == 0)
+    return 0;
+  pte = walkpgdir(pgdir, (char*)va, 0);
+  if(pte == 0 || !(*pte & PTE_P))
+    return 0;
+  if(*pte & PTE_D)
+    return 0;
+  *pte = 0;
+  tlbinval(pgdir, va);
+  proc->npages--;
+  return 1;
+}
+
+// Check that [va, va+len) lies inside one mapped region of the
+// current process, writable if write is set, and fault in its
+// pages, so that system calls can use the range as a buffer.
+// Returns 0 on success.
+int
+mmapcheck(uint va, uint len, int write)
+{
+  struct mmapregion *r;
+
+  if((r = findregion(proc, va)) == 0 || va + len > r->addr + r->len || va + len < va)
+    return -1;
+  if(write && !(r->prot & PROT_WRITE))
+    return -1;
+  return uvmprefault(va, len);
+}
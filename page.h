@@ -0,0 +1,24 @@
+// Physical page frame descriptors.
+//
+// pages[] has one entry for every 4096-byte frame below PHYSTOP.
+// kalloc() and kfree() keep ref; mappages() records the reverse
+// mapping of user pages; the pager (vm.c) keeps each process's
+// resident pages on its struct lru (see proc.h).
+
+struct page {
+  ushort ref;              // references; the frame is free when 0
+  ushort flags;
+  pde_t *pgdir;            // reverse map: page table mapping the frame
+  uint va;                 //   and the user address it is mapped at
+  struct lru *lru;         // replacement list the frame is on, or 0
+  struct page *next;       // on lru: next older page
+  struct page *prev;       // on lru: next newer page
+  uint accessCount;        // ticks in which the page was accessed (LAP)
+};
+#define PG_MAPPED 0x1      // pgdir and va are valid
+#define PG_PINNED 0x2      // on lru, but not to be evicted (see uvmprefault)
+
+extern struct page pages[];
+
+#define pa2page(pa)  (&pages[(uint)(pa) / PGSIZE])
+#define page2pa(pg)  ((uint)((pg) - pages) * PGSIZE)
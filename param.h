@@ -2,8 +2,6 @@
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
@@ -11,4 +9,26 @@
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       1000  // size of file system in blocks
+#define NMMAP         8  // mapped file regions per process
+#define NPCACHE    2048  // maximum number of pages in the page cache
+#define PCMINFREE     8  // page cache stops growing below 1/PCMINFREE free memory
+#define MAXSTACKPAGES 8  // user stack pages, grown on demand up to this limit
+#define TLBFLUSHMAX  32  // invalidating more pages than this reloads CR3 instead
+#define KMAGSIZE     32  // free pages cached per CPU by kalloc
+#define KMAGBATCH    16  // pages moved between a CPU cache and the free list at once
+#define ZPOOLSIZE    64  // free pages kept zeroed by the idle loop
+#define NSLABCACHE    8  // slab caches
+#define SLABMAG      16  // free objects cached per CPU by each slab cache
+#define SLABBATCH     8  // objects moved between a CPU cache and the slabs at once
+#define NPRIO         4  // scheduling priority levels
+#define BOOSTTICKS  100  // ticks between returns of all processes to their base level
+#define NWAITHASH    64  // wait queues for sleep/wakeup channels
+#define NPIDHASH     64  // pid hash table chains
+#define NLATBUCKET    8  // buckets of the scheduling latency histograms
+#define NTICKETS    100  // default tickets for STRIDE and LOTTERY scheduling
+#define MAXTICKETS 10000 // most tickets one process may hold
+#define LOADTICKS    10  // ticks between load control checks
+#define THRASHHIGH   64  // swap I/Os per check above which a process is suspended
+#define THRASHLOW    16  // swap I/Os per check below which one is resumed
+#define NSWAPFILE     8  // swap files shared by the processes that page out
 
@@ -0,0 +1,359 @@
+// Page cache.
+//
+// The page cache keeps whole 4096-byte pages of regular file
+// contents in frames obtained from kalloc(), indexed by
+// (device, inode number, page offset in the file).  readi() of a
+// T_FILE inode copies out of the page cache; only misses go down
+// to the buffer cache, which then holds just the blocks in flight
+// and file system metadata.
+//
+// Interface:
+// * pcread copies file data out of the cache, filling pages on a miss.
+// * pcwrite updates cached pages after writei has written the
+//     data through the buffer cache and log (write-through).
+// * pcinval drops every page of an inode (called when it is truncated).
+// * pcreclaim gives one frame back to kalloc under memory pressure.
+//
+// The caller must hold the inode lock, so at most one process
+// fills or updates the pages of a given inode at a time.  A page
+// in use by pcread or pcwrite is pinned (ref > 0) so that another CPU cannot
+// evict it while its contents are being copied.
+//
+// The cache grows while free memory is plentiful, up to NPCACHE
+// pages, and recycles its own pages otherwise.  The struct cpage
+// describing each page comes from a slab cache.  Pages are kept on
+// a list in fill order, newest first, and victims are chosen from
+// it with the same policy that is selected for user pages
+// (SELECTION in the Makefile).
+//
+// The cache is separate from process page replacement: a mapped
+// file page (mmap.c) is read through readi into a frame of its own,
+// so it is cached twice, and cache pages are not on any process's
+// LRU list.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "fs.h"
+#include "file.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define PCHASH 256
+
+struct cpage {
+  uint dev;
+  uint inum;
+  uint pgoff;             // page number within the file
+  char *data;             // kalloc()ed frame
+  int ref;                // pinned by pcread/pcwrite while non-zero
+  int accessed;           // referenced since last considered (SCFIFO)
+  uint accessCount;       // hits (LAP)
+  struct cpage *hnext;    // hash chain
+  struct cpage *next;     // list of all pages, newest first
+  struct cpage *prev;
+};
+
+struct {
+  struct spinlock lock;
+  struct slabcache *cache;
+  struct cpage *pages;    // every cached page, newest first
+  struct cpage *oldest;   // last on pages
+  struct cpage *hash[PCHASH];
+  int npages;             // slots holding a frame
+  uint hits;
+  uint misses;
+} pcache;
+
+static uint
+pchash(uint dev, uint inum, uint pgoff)
+{
+  return (dev * 31 + inum * 17 + pgoff) % PCHASH;
+}
+
+void
+pcinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  pcache.cache = slabcreate("cpage", sizeof(struct cpage), 0);
+}
+
+static struct cpage*
+pclookup(uint dev, uint inum, uint pgoff)
+{
+  struct cpage *cp;
+
+  for(cp = pcache.hash[pchash(dev, inum, pgoff)]; cp; cp = cp->hnext)
+    if(cp->dev == dev && cp->inum == inum && cp->pgoff == pgoff)
+      return cp;
+  return 0;
+}
+
+static void
+pcunhash(struct cpage *cp)
+{
+  struct cpage **pp;
+
+  for(pp = &pcache.hash[pchash(cp->dev, cp->inum, cp->pgoff)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == cp){
+      *pp = cp->hnext;
+      break;
+    }
+  }
+  cp->hnext = 0;
+}
+
+// Put cp on the page list as the newest page.  Caller holds pcache.lock.
+static void
+pclink(struct cpage *cp)
+{
+  cp->prev = 0;
+  cp->next = pcache.pages;
+  if(cp->next)
+    cp->next->prev = cp;
+  else
+    pcache.oldest = cp;
+  pcache.pages = cp;
+}
+
+// Take cp off the page list.  Caller holds pcache.lock.
+static void
+pcunlink(struct cpage *cp)
+{
+  if(cp->prev)
+    cp->prev->next = cp->next;
+  else
+    pcache.pages = cp->next;
+  if(cp->next)
+    cp->next->prev = cp->prev;
+  else
+    pcache.oldest = cp->prev;
+  cp->next = cp->prev = 0;
+}
+
+// Choose an unpinned page to evict, following the user page
+// replacement policy.  Caller holds pcache.lock.
+static struct cpage*
+pcvictim(void)
+{
+  struct cpage *cp, *victim;
+  int n;
+
+#if LIFO
+  (void)victim; (void)n;
+  for(cp = pcache.pages; cp; cp = cp->next)
+    if(cp->ref == 0)
+      return cp;
+  return 0;
+#elif LAP
+  (void)n;
+  victim = 0;
+  for(cp = pcache.pages; cp; cp = cp->next)
+    if(cp->ref == 0 && (!victim || cp->accessCount < victim->accessCount))
+      victim = cp;
+  return victim;
+#else
+  // Second chance FIFO, as a clock: the oldest page goes unless it
+  // is pinned or was accessed; then it loses its accessed bit and
+  // becomes the newest.  Two turns clear every accessed bit.
+  (void)victim;
+  for(n = 2*pcache.npages; n > 0 && (cp = pcache.oldest) != 0; n--){
+    if(cp->ref == 0 && !cp->accessed)
+      return cp;
+    cp->accessed = 0;
+    pcunlink(cp);
+    pclink(cp);
+  }
+  return 0;
+#endif
+}
+
+// Remove cp from the cache, free it and return its frame.
+// Caller holds pcache.lock.
+static char*
+pcevict(struct cpage *cp)
+{
+  char *mem;
+
+  pcunhash(cp);
+  pcunlink(cp);
+  mem = cp->data;
+  pcache.npages--;
+  slabfree(cp);
+  return mem;
+}
+
+// Get a frame for a new cache page: a fresh one while free memory
+// is plentiful, otherwise the frame of a victim page.
+static char*
+pcframe(void)
+{
+  struct cpage *cp;
+  char *mem;
+
+  if(pcache.npages < NPCACHE && getFreePages() > getTotalPages() / PCMINFREE){
+    if((mem = kalloc()) != 0)
+      return mem;
+  }
+  acquire(&pcache.lock);
+  mem = 0;
+  if((cp = pcvictim()) != 0)
+    mem = pcevict(cp);
+  release(&pcache.lock);
+  return mem;
+}
+
+// Return the cached page pgoff of ip, pinned, reading it from
+// disk if needed.  Returns 0 if no frame could be found.
+static struct cpage*
+pcget(struct inode *ip, uint pgoff)
+{
+  struct cpage *cp;
+  char *mem;
+  uint off, n;
+
+  acquire(&pcache.lock);
+  if((cp = pclookup(ip->dev, ip->inum, pgoff)) != 0){
+    cp->ref++;
+    cp->accessed = 1;
+    cp->accessCount++;
+    pcache.hits++;
+    release(&pcache.lock);
+    return cp;
+  }
+  pcache.misses++;
+  release(&pcache.lock);
+
+  // Fill outside the lock; the inode lock keeps others from
+  // filling the same page meanwhile.
+  if((mem = pcframe()) == 0)
+    return 0;
+  off = pgoff * PGSIZE;
+  n = min(PGSIZE, ip->size - off);
+  if(readblocks(ip, mem, off, n) != n){
+    kfree(mem);
+    return 0;
+  }
+  memset(mem + n, 0, PGSIZE - n);
+
+  if((cp = slaballoc(pcache.cache)) == 0){
+    kfree(mem);
+    return 0;
+  }
+  acquire(&pcache.lock);
+  cp->dev = ip->dev;
+  cp->inum = ip->inum;
+  cp->pgoff = pgoff;
+  cp->data = mem;
+  cp->ref = 1;
+  cp->accessed = 0;
+  cp->accessCount = 0;
+  cp->hnext = pcache.hash[pchash(cp->dev, cp->inum, pgoff)];
+  pcache.hash[pchash(cp->dev, cp->inum, pgoff)] = cp;
+  pclink(cp);
+  pcache.npages++;
+  release(&pcache.lock);
+  return cp;
+}
+
+static void
+pcput(struct cpage *cp)
+{
+  acquire(&pcache.lock);
+  cp->ref--;
+  release(&pcache.lock);
+}
+
+// Read n bytes at off from the file ip through the page cache.
+// The range must already be clipped to the file size.
+// Caller must hold ip's lock.
+int
+pcread(struct inode *ip, char *dst, uint off, uint n)
+{
+  uint tot, m;
+  struct cpage *cp;
+
+  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    if((cp = pcget(ip, off/PGSIZE)) == 0){
+      // Out of memory: bypass the cache.
+      if(readblocks(ip, dst, off, m) != m)
+        return -1;
+      continue;
+    }
+    memmove(dst, cp->data + off%PGSIZE, m);
+    pcput(cp);
+  }
+  return n;
+}
+
+// Copy freshly written file data into any cached pages it covers.
+// src may be user memory, so each page is pinned and copied
+// outside pcache.lock.  Caller must hold ip's lock.
+void
+pcwrite(struct inode *ip, char *src, uint off, uint n)
+{
+  uint tot, m;
+  struct cpage *cp;
+
+  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    acquire(&pcache.lock);
+    if((cp = pclookup(ip->dev, ip->inum, off/PGSIZE)) != 0)
+      cp->ref++;
+    release(&pcache.lock);
+    if(cp){
+      memmove(cp->data + off%PGSIZE, src, m);
+      pcput(cp);
+    }
+  }
+}
+
+// Drop every cached page of ip.  Caller must hold ip's lock.
+void
+pcinval(struct inode *ip)
+{
+  struct cpage *cp;
+  char *mem;
+
+  acquire(&pcache.lock);
+again:
+  for(cp = pcache.pages; cp; cp = cp->next){
+    if(cp->dev == ip->dev && cp->inum == ip->inum){
+      mem = pcevict(cp);
+      release(&pcache.lock);
+      kfree(mem);
+      acquire(&pcache.lock);
+      goto again;
+    }
+  }
+  release(&pcache.lock);
+}
+
+// Free one cached page for kalloc().  Returns 1 if a
+// frame was released.
+int
+pcreclaim(void)
+{
+  struct cpage *cp;
+  char *mem;
+
+  acquire(&pcache.lock);
+  if(pcache.npages == 0 || (cp = pcvictim()) == 0){
+    release(&pcache.lock);
+    return 0;
+  }
+  mem = pcevict(cp);
+  release(&pcache.lock);
+  kfree(mem);
+  return 1;
+}
+
+// Print page cache usage.  For procdump.
+void
+pcstat(void)
+{
+  cprintf("page cache: %d pages, %d hits, %d misses\n",
+          pcache.npages, pcache.hits, pcache.misses);
+}
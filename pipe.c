@@ -18,6 +18,20 @@ struct pipe {
   int writeopen;  // write fd is still open
 };
 
+static struct slabcache *pipecache;
+
+static void
+pipector(void *p)
+{
+  initlock(&((struct pipe*)p)->lock, "pipe");
+}
+
+void
+pipeinit(void)
+{
+  pipecache = slabcreate("pipe", sizeof(struct pipe), pipector);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -27,13 +41,12 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((p = (struct pipe*)kalloc()) == 0)
+  if((p = slaballoc(pipecache)) == 0)
     goto bad;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
   p->nread = 0;
-  initlock(&p->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -47,7 +60,7 @@ pipealloc(struct file **f0, struct file **f1)
 //PAGEBREAK: 20
  bad:
   if(p)
-    kfree((char*)p);
+    slabfree(p);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,7 +81,7 @@ pipeclose(struct pipe *p, int writable)
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
-    kfree((char*)p);
+    slabfree(p);
   } else
     release(&p->lock);
 }
@@ -86,12 +99,12 @@ pipewrite(struct pipe *p, char *addr, int n)
         release(&p->lock);
         return -1;
       }
-      wakeup(&p->nread);
+      wakeupone(&p->nread);
       sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
     }
     p->data[p->nwrite++ % PIPESIZE] = addr[i];
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+  wakeupone(&p->nread);  //DOC: pipewrite-wakeup1
   release(&p->lock);
   return n;
 }
@@ -104,6 +117,7 @@ piperead(struct pipe *p, char *addr, int n)
   acquire(&p->lock);
   while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
     if(proc->killed){
+      wakeupone(&p->nread);  // pass on a wakeup meant for us
       release(&p->lock);
       return -1;
     }
@@ -114,6 +128,8 @@ piperead(struct pipe *p, char *addr, int n)
       break;
     addr[i] = p->data[p->nread++ % PIPESIZE];
   }
+  if(p->nread != p->nwrite)
+    wakeupone(&p->nread);  // data left for the next reader
   wakeup(&p->nwrite);  //DOC: piperead-wakeup
   release(&p->lock);
   return i;
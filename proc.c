@@ -4,26 +4,325 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "x86.h"
+#include "traps.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "schedstat.h"
+
+// Locking.  Each proc slot has a lock, PLOCK(p), that protects
+// p->state, p->chan and p->killed and that a process holds across
+// its switches to and from the scheduler.  treelock protects
+// p->parent and the child lists, and exit() and wait() use it to
+// hand a zombie to its parent.  ptable.lock protects nextpid, the
+// pid hash and the free list of slots.  Statistics and scheduling
+// hints (p->pgio, p->prio) are read without locks.
+//
+// Processes are found by pid through a hash table, and by parent
+// through each process's list of children, so no process operation
+// scans the table.
+//
+// Sleeping processes are kept on wait queues, found by hashing
+// their wait channel, so that wakeup() looks only at processes
+// that may be sleeping on its channel.  Queues are FIFO and each
+// has its own lock.  Lock order: a sleep lock or treelock, then
+// ptable.lock, then a wait queue lock, then PLOCK(p), then a run
+// queue lock.
+#define WAITHASH(chan) (((uint)(chan) >> 2) % NWAITHASH)
+#define PIDHASH(pid) ((uint)(pid) % NPIDHASH)
+#define PLOCK(p) (&ptable.plock[(p) - ptable.proc])
+
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+  struct proc *tail;
+};
 
 struct {
   struct spinlock lock;
   struct proc proc[NPROC];
+  struct spinlock plock[NPROC];
+  struct waitq waitq[NWAITHASH];
+  struct proc *pidhash[NPIDHASH];  // chained through p->hnext
+  struct proc *free;               // UNUSED slots, chained through p->hnext
 } ptable;
 
+static struct spinlock treelock;
+static struct spinlock loadlock;   // see loadctl
+// Per-CPU run queues, indexed like cpus[].  A process is on a run
+// queue exactly when it is RUNNABLE, normally on the queue of the
+// CPU it last ran on; an idle CPU steals from the longest queue.
+// Only the scheduler takes a process off a queue; it then takes
+// PLOCK(p) to run it.
+//
+// Each queue has NPRIO levels, 0 the highest, and the scheduler runs
+// the first process of the highest non-empty level (a multi-level
+// feedback queue).  A process at level l may run SLICE(l) timer ticks
+// before dropping a level; it rises a level each time it blocks, and
+// every BOOSTTICKS ticks all processes return to their base level,
+// p->nice, so none starves.
+//
+// Built with SCHEDPOLICY=STRIDE or LOTTERY (see the Makefile), the
+// scheduler instead shares each CPU among its queued processes in
+// proportion to their tickets, using only level 0 and a one-tick
+// slice.  STRIDE runs the process with the lowest pass, which
+// advances by stride = STRIDE1/tickets per tick run; a process
+// joining a queue starts no lower than the pass of the process last
+// picked from it.  LOTTERY draws a random ticket.  Picking scans the
+// queue, so it costs time linear in the processes queued on the CPU.
+#define SLICE(l) (1 << (l))
+#define STRIDE1 (1 << 20)
+
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NPRIO];
+  struct proc *tail[NPRIO];
+  int n;
+  uint pass;                  // pass of the last process picked (STRIDE)
+  uint seed;                  // random number state (LOTTERY)
+} runq[NCPU];
+
 static struct proc *initproc;
 
 int nextpid = 1;
 extern void forkret(void);
 extern void trapret(void);
 
-static void wakeup1(void *chan);
-
 void
 pinit(void)
 {
+  int i;
+
   initlock(&ptable.lock, "ptable");
+  initlock(&treelock, "proctree");
+  initlock(&loadlock, "loadctl");
+  for(i = NPROC-1; i >= 0; i--){
+    initlock(&ptable.plock[i], "proc");
+    ptable.proc[i].hnext = ptable.free;
+    ptable.free = &ptable.proc[i];
+  }
+  for(i = 0; i < NWAITHASH; i++)
+    initlock(&ptable.waitq[i].lock, "waitq");
+  for(i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+}
+
+//PAGEBREAK: 30
+// Append p to its level of run queue q.  Caller holds q->lock.
+static void
+runqpush(struct runq *q, struct proc *p)
+{
+  int l;
+
+#if STRIDE || LOTTERY
+  l = 0;
+  if((int)(p->pass - q->pass) < 0)
+    p->pass = q->pass;
+#else
+  l = p->prio;  // read once: priboost() sets it without q->lock
+#endif
+  p->rqnext = 0;
+  if(q->tail[l])
+    q->tail[l]->rqnext = p;
+  else
+    q->head[l] = p;
+  q->tail[l] = p;
+  q->n++;
+}
+
+// Get an idle CPU out of hlt to run p, just put on the run queue
+// of p->cpu: that CPU itself if idle, else any idle CPU p may run
+// on, which will steal it.
+static void
+kickidle(struct proc *p)
+{
+  int c;
+
+  c = p->cpu;
+  if(!cpus[c].idle){
+    for(c = 0; c < ncpu; c++)
+      if(cpus[c].idle && (p->cpumask & (1 << c)))
+        break;
+    if(c == ncpu)
+      return;
+  }
+  if(&cpus[c] != cpu)
+    lapicipi(cpus[c].id, T_WAKEUP);
+}
+
+// Make p RUNNABLE and put it on the run queue of p->cpu, or, if
+// its affinity mask no longer allows that CPU, of the allowed CPU
+// with the shortest queue.
+// Caller holds PLOCK(p).
+static void
+setrunnable(struct proc *p)
+{
+  struct runq *q;
+  int c;
+
+  if(!(p->cpumask & (1 << p->cpu))){
+    for(c = 0; c < ncpu; c++)
+      if((p->cpumask & (1 << c)) &&
+         (!(p->cpumask & (1 << p->cpu)) || runq[c].n < runq[p->cpu].n))
+        p->cpu = c;
+  }
+  p->state = RUNNABLE;
+  p->readytsc = rdtsc();
+  q = &runq[p->cpu];
+  acquire(&q->lock);
+  runqpush(q, p);
+  release(&q->lock);  // orders the push before kickidle's reads
+  kickidle(p);
+}
+
+// Highest level with a process waiting on q, or NPRIO if none.
+// Unlocked, so only a hint.
+static int
+runqtop(struct runq *q)
+{
+  int l;
+
+  for(l = 0; l < NPRIO; l++)
+    if(q->head[l])
+      break;
+  return l;
+}
+
+// Take p, which follows prev, off level l of run queue q.
+// Caller holds q->lock.
+static void
+runqunlink(struct runq *q, int l, struct proc *prev, struct proc *p)
+{
+  if(prev)
+    prev->rqnext = p->rqnext;
+  else
+    q->head[l] = p->rqnext;
+  if(q->tail[l] == p)
+    q->tail[l] = prev;
+  q->n--;
+}
+
+#if STRIDE || LOTTERY
+// Choose among the processes on run queue q that may run on CPU c
+// the one to run next, in proportion to their tickets, and set
+// *prevp to the process before it.  Caller holds q->lock.
+static struct proc*
+runqpick(struct runq *q, int c, struct proc **prevp)
+{
+  struct proc *p, *prev, *best;
+#if LOTTERY
+  uint total, draw;
+
+  total = 0;
+  for(p = q->head[0]; p; p = p->rqnext)
+    if(p->cpumask & (1 << c))
+      total += p->tickets;
+  if(total == 0)
+    return 0;
+  q->seed = q->seed * 1103515245 + 12345;
+  draw = (q->seed >> 8) % total;
+#endif
+
+  best = 0;
+  for(prev = 0, p = q->head[0]; p; prev = p, p = p->rqnext){
+    if(!(p->cpumask & (1 << c)))
+      continue;
+#if LOTTERY
+    if(draw < p->tickets){
+      *prevp = prev;
+      return p;
+    }
+    draw -= p->tickets;
+#else
+    if(best == 0 || (int)(p->pass - best->pass) < 0){
+      best = p;
+      *prevp = prev;
+    }
+#endif
+  }
+  return best;
+}
+#endif
+
+// Take off run queue q the first process of the highest level
+// that may run on CPU c, or return 0.
+static struct proc*
+runqpop(struct runq *q, int c)
+{
+  struct proc *p, *prev;
+  int l;
+
+  if(q->n == 0)
+    return 0;
+  acquire(&q->lock);
+#if STRIDE || LOTTERY
+  (void)l;
+  if((p = runqpick(q, c, &prev)) != 0){
+    runqunlink(q, 0, prev, p);
+    q->pass = p->pass;
+  }
+  release(&q->lock);
+  return p;
+#endif
+  for(l = 0; l < NPRIO; l++){
+    prev = 0;
+    for(p = q->head[l]; p; prev = p, p = p->rqnext){
+      if(p->cpumask & (1 << c)){
+        runqunlink(q, l, prev, p);
+        release(&q->lock);
+        return p;
+      }
+    }
+  }
+  release(&q->lock);
+  return 0;
+}
+
+// Take p off run queue q.  Returns 0 if it was not there: a
+// scheduler has already taken it.
+static int
+runqremove(struct runq *q, struct proc *p)
+{
+  struct proc *pp, *prev;
+  int l;
+
+  acquire(&q->lock);
+  for(l = 0; l < NPRIO; l++){
+    prev = 0;
+    for(pp = q->head[l]; pp; prev = pp, pp = pp->rqnext){
+      if(pp == p){
+        runqunlink(q, l, prev, p);
+        release(&q->lock);
+        return 1;
+      }
+    }
+  }
+  release(&q->lock);
+  return 0;
+}
+
+// Choose the next process for CPU c: the head of its own queue,
+// else one stolen from the longest other queue, or failing that
+// from any queue holding a process allowed on c.
+static struct proc*
+runqget(int c)
+{
+  struct proc *p;
+  int i, busiest;
+
+  if((p = runqpop(&runq[c], c)) != 0)
+    return p;
+  busiest = -1;
+  for(i = 0; i < ncpu; i++)
+    if(i != c && runq[i].n > 0 && (busiest < 0 || runq[i].n > runq[busiest].n))
+      busiest = i;
+  if(busiest < 0)
+    return 0;
+  if((p = runqpop(&runq[busiest], c)) != 0)
+    return p;
+  for(i = 0; i < ncpu; i++)
+    if(i != c && i != busiest && (p = runqpop(&runq[i], c)) != 0)
+      return p;
+  return 0;
 }
 
 
@@ -33,9 +332,29 @@ void initSwapStructs(struct proc* p) {
     p->fileCtrlr[i].state = NOTUSED;
 }
 
+// Remove p from the pid hash and put its slot back on the free list.
+static void
+pfree(struct proc *p)
+{
+  struct proc **pp;
+
+  acquire(&ptable.lock);
+  for(pp = &ptable.pidhash[PIDHASH(p->pid)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == p){
+      *pp = p->hnext;
+      break;
+    }
+  }
+  p->pid = 0;
+  p->state = UNUSED;
+  p->hnext = ptable.free;
+  ptable.free = p;
+  release(&ptable.lock);
+}
+
 //PAGEBREAK: 32
-// Look in the process table for an UNUSED proc.
-// If found, change state to EMBRYO and initialize
+// Take an UNUSED proc off the free list.
+// If there is one, change state to EMBRYO and initialize
 // state required to run in the kernel.
 // Otherwise return 0.
 static struct proc*
@@ -45,20 +364,20 @@ allocproc(void)
   char *sp;
 
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == UNUSED)
-      goto found;
-  release(&ptable.lock);
-  return 0;
-
-found:
+  if((p = ptable.free) == 0){
+    release(&ptable.lock);
+    return 0;
+  }
+  ptable.free = p->hnext;
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->hnext = ptable.pidhash[PIDHASH(p->pid)];
+  ptable.pidhash[PIDHASH(p->pid)] = p;
   release(&ptable.lock);
 
   // Allocate kernel stack.
   if((p->kstack = kalloc()) == 0){
-    p->state = UNUSED;
+    pfree(p);
     return 0;
   }
   sp = p->kstack + KSTACKSIZE;
@@ -66,13 +385,24 @@ found:
   // Leave room for trap frame.
   sp -= sizeof *p->tf;
   p->tf = (struct trapframe*)sp;
-  p->loadOrderCounter = 0;
+  p->lru.head = 0;
+  p->lru.n = 0;
+  p->lru.npinned = 0;
+  p->npages = 0;
   p->faultCounter = 0;
   p->countOfPagedOut = 0;
-
-    if(p->pid > 2)
-      createSwapFile(p);
-    
+  p->swapFile = 0;      //taken from the pool on first page-out
+  p->nice = 0;
+  p->prio = 0;
+  p->ticks = 0;
+  p->pgio = 0;
+  p->suspended = 0;
+  p->cpumask = (1 << NCPU) - 1;
+  p->tickets = NTICKETS;
+  p->stride = STRIDE1 / NTICKETS;
+  p->pass = 0;
+  p->nvcsw = p->nivcsw = p->runticks = 0;
+  memset(p->lat, 0, sizeof(p->lat));
 
   // Set up new context to start executing at forkret,
   // which returns to trapret.
@@ -101,6 +431,7 @@ userinit(void)
     panic("userinit: out of memory?");
   inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
   p->sz = PGSIZE;
+  p->stackLimit = p->stackBottom = 0; // initcode's stack does not grow
   memset(p->tf, 0, sizeof(*p->tf));
   p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
   p->tf->ds = (SEG_UDATA << 3) | DPL_USER;
@@ -113,7 +444,9 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  acquire(PLOCK(p));
+  setrunnable(p);
+  release(PLOCK(p));
 }
 
 // Grow current process's memory by n bytes.
@@ -151,27 +484,37 @@ fork(void)
     return -1;
 
   // Copy process state from p.
-  if((np->pgdir = copyuvm(proc->pgdir, proc->sz)) == 0){
+  if((np->pgdir = copyuvm(proc->pgdir, proc->sz, isNONEpolicy() || np->pid <= 2)) == 0){
     kfree(np->kstack);
     np->kstack = 0;
-    np->state = UNUSED;
+    pfree(np);
     return -1;
   }
   np->sz = proc->sz;
+  np->stackLimit = proc->stackLimit;
+  np->stackBottom = proc->stackBottom;
+  np->npages = proc->npages;
+  if(mmapfork(np) < 0){
+    freevm(np->pgdir);
+    kfree(np->kstack);
+    np->kstack = 0;
+    pfree(np);
+    return -1;
+  }
     if (proc->pid > 2){
       copySwapFile(proc, np);
-      np->loadOrderCounter = proc->loadOrderCounter;
-      for (i = 0; i < MAX_PYSC_PAGES; i++){
-        np->ramCtrlr[i] = proc->ramCtrlr[i]; //deep copies ramCtrlr list
-        np->ramCtrlr[i].pgdir = np->pgdir;  //replace parent pgdir with child new pgdir
-      }
+      copyLRU(np);
       for (i = 0; i < MAX_TOTAL_PAGES-MAX_PYSC_PAGES; i++){
         np->fileCtrlr[i] = proc->fileCtrlr[i]; //deep copies fileCtrlr list
         np->fileCtrlr[i].pgdir = np->pgdir;   //replace parent pgdir with child new pgdir
       }
     }
 
+  acquire(&treelock);
   np->parent = proc;
+  np->sibling = proc->children;
+  proc->children = np;
+  release(&treelock);
   *np->tf = *proc->tf;
 
   // Clear %eax so that fork returns 0 in the child.
@@ -189,10 +532,15 @@ fork(void)
   np->countOfPagedOut = 0;
 
 
-  // lock to force the compiler to emit the np->state write last.
-  acquire(&ptable.lock);
-  np->state = RUNNABLE;
-  release(&ptable.lock);
+  // The child starts on the parent's CPU; an idle CPU may steal it.
+  np->cpu = proc->cpu;
+  np->nice = np->prio = proc->nice;
+  np->cpumask = proc->cpumask;
+  np->tickets = proc->tickets;
+  np->stride = proc->stride;
+  acquire(PLOCK(np));
+  setrunnable(np);
+  release(PLOCK(np));
   return pid;
 }
 
@@ -208,6 +556,9 @@ exit(void)
   if(proc == initproc)
     panic("init exiting");
 
+  // Write back and release memory-mapped files.
+  munmapall();
+
   // Close all open files.
   for(fd = 0; fd < NOFILE; fd++){
     if(proc->ofile[fd]){
@@ -215,8 +566,7 @@ exit(void)
       proc->ofile[fd] = 0;
     }
   }
-  if (proc->pid > 2) 
-    removeSwapFile(proc);
+  releaseSwapFile(proc);
 
 
   begin_op();
@@ -225,21 +575,30 @@ exit(void)
   proc->cwd = 0;
 
 
-  acquire(&ptable.lock);
+  acquire(&treelock);
 
   // Parent might be sleeping in wait().
-  wakeup1(proc->parent);
+  wakeup(proc->parent);
 
   // Pass abandoned children to init.
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->parent == proc){
+  // Zombies become so holding treelock, so p->state is stable here.
+  if((p = proc->children) != 0){
+    for(;;){
       p->parent = initproc;
       if(p->state == ZOMBIE)
-        wakeup1(initproc);
+        wakeup(initproc);
+      if(p->sibling == 0)
+        break;
+      p = p->sibling;
     }
+    p->sibling = initproc->children;
+    initproc->children = proc->children;
+    proc->children = 0;
   }
 
+  acquire(PLOCK(proc));
   proc->state = ZOMBIE;
+  release(&treelock);
       
   #if TRUE
     procdump();
@@ -255,49 +614,63 @@ exit(void)
 int
 wait(void)
 {
-  struct proc *p;
-  int havekids, pid;
+  struct proc *p, **pp;
+  int pid;
 
-  acquire(&ptable.lock);
+  acquire(&treelock);
   for(;;){
-    // Scan through table looking for zombie children.
-    havekids = 0;
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != proc)
-        continue;
-      havekids = 1;
+    // Scan through the children looking for zombies.
+    for(pp = &proc->children; (p = *pp) != 0; pp = &p->sibling){
+      // A zombie holds its lock until it is off its CPU.
+      acquire(PLOCK(p));
       if(p->state == ZOMBIE){
-        // Found one.
+        // Found one.  Only its parent, holding treelock,
+        // touches it from now on.
+        release(PLOCK(p));
+        *pp = p->sibling;
         pid = p->pid;
         kfree(p->kstack);
         p->kstack = 0;
         freevm(p->pgdir);
-        p->state = UNUSED;
-        p->pid = 0;
         int i;
-        for (i = 0; i < MAX_PYSC_PAGES; i++)
-          p->ramCtrlr[i].state = NOTUSED;
         for (i = 0; i < MAX_TOTAL_PAGES-MAX_PYSC_PAGES; i++)
           p->fileCtrlr[i].state = NOTUSED;
         p->parent = 0;
+        p->sibling = 0;
         p->name[0] = 0;
         p->killed = 0;
-        release(&ptable.lock);
+        pfree(p);
+        release(&treelock);
         return pid;
       }
+      release(PLOCK(p));
     }
 
     // No point waiting if we don't have any children.
-    if(!havekids || proc->killed){
-      release(&ptable.lock);
+    if(proc->children == 0 || proc->killed){
+      release(&treelock);
       return -1;
     }
 
-    // Wait for children to exit.  (See wakeup1 call in proc_exit.)
-    sleep(proc, &ptable.lock);  //DOC: wait-sleep
+    // Wait for children to exit.  (See wakeup call in exit.)
+    sleep(proc, &treelock);  //DOC: wait-sleep
   }
 }
 
+// Count a wait of cycles TSC cycles by p for a CPU, in buckets
+// that grow by a factor of 4 (see schedstat.h).
+static void
+latcount(struct proc *p, uint64 cycles)
+{
+  int b;
+
+  cycles >>= 14;
+  for(b = 0; cycles && b < NLATBUCKET-1; b++)
+    cycles >>= 2;
+  p->lat[b]++;
+  cpu->lat[b]++;
+}
+
 //PAGEBREAK: 42
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
@@ -310,44 +683,60 @@ void
 scheduler(void)
 {
   struct proc *p;
+  int c;
 
+  c = cpu - cpus;
   for(;;){
     // Enable interrupts on this processor.
     sti();
 
-    // Loop over process table looking for process to run.
-    acquire(&ptable.lock);
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE)
+    if((p = runqget(c)) == 0){
+      // Nothing to run: use the time to zero pages for kalloc_zeroed(),
+      // and when there are none to zero, halt until an interrupt.
+      // Once idle is set, setrunnable() sends a wakeup IPI for a
+      // process queued after the check below.
+      if(kzerofill())
         continue;
-
-      // Switch to chosen process.  It is the process's job
-      // to release ptable.lock and then reacquire it
-      // before jumping back to us.
-      proc = p;
-      switchuvm(p);
-      p->state = RUNNING;
-      swtch(&cpu->scheduler, proc->context);
-      switchkvm();
-
-      // Process is done running for now.
-      // It should have changed its p->state before coming back.
-      proc = 0;
+      cli();
+      xchg(&cpu->idle, 1);
+      if(runq[c].n == 0)
+        stihlt();
+      cpu->idle = 0;
+      continue;
     }
-    release(&ptable.lock);
 
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    acquire(PLOCK(p));
+    if(p->state != RUNNABLE)
+      panic("scheduler: not runnable");
+    latcount(p, rdtsc() - p->readytsc);
+    cpu->nswtch++;
+    proc = p;
+    p->cpu = c;
+    switchuvm(p);
+    p->state = RUNNING;
+    swtch(&cpu->scheduler, proc->context);
+    switchkvm();
+    cpu->pgdir = 0;
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    proc = 0;
+    release(PLOCK(p));
   }
 }
 
-// Enter scheduler.  Must hold only ptable.lock
+// Enter scheduler.  Must hold only PLOCK(proc)
 // and have changed proc->state.
 void
 sched(void)
 {
   int intena;
 
-  if(!holding(&ptable.lock))
-    panic("sched ptable.lock");
+  if(!holding(PLOCK(proc)))
+    panic("sched proc lock");
   if(cpu->ncli != 1)
     panic("sched locks");
   if(proc->state == RUNNING)
@@ -363,10 +752,87 @@ sched(void)
 void
 yield(void)
 {
-  acquire(&ptable.lock);  //DOC: yieldlock
-  proc->state = RUNNABLE;
+  acquire(PLOCK(proc));  //DOC: yieldlock
+  proc->nivcsw++;
+  cpu->nivcsw++;
+  setrunnable(proc);
   sched();
-  release(&ptable.lock);
+  release(PLOCK(proc));
+}
+
+// Charge a timer tick to the current process.  Returns 1 if it
+// should give up the CPU: it has used up its slice, and drops a
+// level, or a process of a higher level is waiting on this CPU.
+int
+schedtick(void)
+{
+#if STRIDE || LOTTERY
+  proc->pass += proc->stride;
+  return 1;
+#endif
+  if(++proc->ticks >= SLICE(proc->prio)){
+    if(proc->prio < NPRIO-1)
+      proc->prio++;
+    proc->ticks = 0;
+    return 1;
+  }
+  return runqtop(&runq[cpu - cpus]) < proc->prio;
+}
+
+// Return every process to its base level.  Called every
+// BOOSTTICKS timer ticks.
+void
+priboost(void)
+{
+  struct proc *p, *next, *head[NPRIO];
+  struct runq *q;
+  int l;
+
+#if STRIDE || LOTTERY
+  return;  // one level only
+#endif
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    p->prio = p->nice;
+    p->ticks = 0;
+  }
+  for(q = runq; q < &runq[ncpu]; q++){
+    acquire(&q->lock);
+    for(l = 0; l < NPRIO; l++){
+      head[l] = q->head[l];
+      q->head[l] = q->tail[l] = 0;
+    }
+    q->n = 0;
+    for(l = 0; l < NPRIO; l++){
+      for(p = head[l]; p; p = next){
+        next = p->rqnext;
+        runqpush(q, p);
+      }
+    }
+    release(&q->lock);
+  }
+}
+
+// Lower the base priority level of the current process by incr
+// levels (a larger level runs later) and return the new level.
+// A process can only lower its priority: raising it, or returning
+// to its base level after being demoted, would let it escape the
+// feedback.  Returns -1 if incr is negative.
+int
+nice(int incr)
+{
+  int n;
+
+  if(incr < 0)
+    return -1;
+  n = proc->nice + incr;
+  if(n > NPRIO-1)
+    n = NPRIO-1;
+  proc->nice = n;
+  if(proc->prio < n){
+    proc->prio = n;
+    proc->ticks = 0;
+  }
+  return n;
 }
 
 // A fork child's very first scheduling by scheduler()
@@ -375,8 +841,8 @@ void
 forkret(void)
 {
   static int first = 1;
-  // Still holding ptable.lock from scheduler.
-  release(&ptable.lock);
+  // Still holding PLOCK(proc) from scheduler.
+  release(PLOCK(proc));
 
   if (first) {
     // Some initialization functions must be run in the context
@@ -385,68 +851,141 @@ forkret(void)
     first = 0;
     iinit(ROOTDEV);
     initlog(ROOTDEV);
+    swapcreate();
   }
   
   // Return to "caller", actually trapret (see allocproc).
 }
 
+//PAGEBREAK: 30
+// Append p to wait queue q.  Caller holds q->lock.
+static void
+waitadd(struct waitq *q, struct proc *p)
+{
+  p->waitq = q;
+  p->wnext = 0;
+  p->wprev = q->tail;
+  if(q->tail)
+    q->tail->wnext = p;
+  else
+    q->head = p;
+  q->tail = p;
+}
+
+// Remove p from its wait queue.  Caller holds p->waitq->lock.
+static void
+waitdel(struct proc *p)
+{
+  struct waitq *q;
+
+  q = p->waitq;
+  if(p->wprev)
+    p->wprev->wnext = p->wnext;
+  else
+    q->head = p->wnext;
+  if(p->wnext)
+    p->wnext->wprev = p->wprev;
+  else
+    q->tail = p->wprev;
+  p->wnext = p->wprev = 0;
+  p->waitq = 0;
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
 {
+  struct waitq *q;
+
   if(proc == 0)
     panic("sleep");
 
   if(lk == 0)
     panic("sleep without lk");
 
-  // Must acquire ptable.lock in order to
+  // Must acquire PLOCK(proc) in order to
   // change p->state and then call sched.
-  // Once we hold ptable.lock, we can be
+  // Once we hold chan's wait queue lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup runs with ptable.lock locked),
+  // (wakeup runs with that lock held),
   // so it's okay to release lk.
-  if(lk != &ptable.lock){  //DOC: sleeplock0
-    acquire(&ptable.lock);  //DOC: sleeplock1
-    release(lk);
+  q = &ptable.waitq[WAITHASH(chan)];
+  acquire(&q->lock);  //DOC: sleeplock1
+  acquire(PLOCK(proc));
+  release(lk);
+
+  // Blocking before the slice is used up earns a higher level.
+  if(proc->prio > proc->nice){
+    proc->prio--;
+    proc->ticks = 0;
   }
 
   // Go to sleep.
+  proc->nvcsw++;
+  cpu->nvcsw++;
   proc->chan = chan;
   proc->state = SLEEPING;
+  waitadd(q, proc);
+  release(&q->lock);
   sched();
 
-  // Tidy up.
+  // Tidy up.  kill() leaves the process on its wait queue.
+  release(PLOCK(proc));
+  acquire(&q->lock);
+  if(proc->waitq)
+    waitdel(proc);
   proc->chan = 0;
+  release(&q->lock);
 
   // Reacquire original lock.
-  if(lk != &ptable.lock){  //DOC: sleeplock2
-    release(&ptable.lock);
-    acquire(lk);
-  }
+  acquire(lk);  //DOC: sleeplock2
 }
 
 //PAGEBREAK!
-// Wake up all processes sleeping on chan.
-// The ptable lock must be held.
+// Wake up processes sleeping on chan: all of them, or only the
+// one that has slept longest.
 static void
-wakeup1(void *chan)
+wakeupn(void *chan, int all)
 {
-  struct proc *p;
-
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan)
-      p->state = RUNNABLE;
+  struct waitq *q;
+  struct proc *p, *next;
+  int woke;
+
+  q = &ptable.waitq[WAITHASH(chan)];
+  acquire(&q->lock);
+  for(p = q->head; p; p = next){
+    next = p->wnext;
+    if(p->chan != chan)
+      continue;
+    woke = 0;
+    acquire(PLOCK(p));
+    if(p->state == SLEEPING){
+      waitdel(p);
+      setrunnable(p);
+      woke = 1;
+    }
+    release(PLOCK(p));
+    if(woke && !all)
+      break;
+  }
+  release(&q->lock);
 }
 
 // Wake up all processes sleeping on chan.
 void
 wakeup(void *chan)
 {
-  acquire(&ptable.lock);
-  wakeup1(chan);
-  release(&ptable.lock);
+  wakeupn(chan, 1);
+}
+
+// Wake up one process sleeping on chan, the one that has slept
+// longest.  For resources that only one waiter can take; a waiter
+// that leaves some for others must wake the next.
+void
+wakeupone(void *chan)
+{
+  wakeupn(chan, 0);
 }
 
 // Kill the process with the given pid.
@@ -458,12 +997,15 @@ kill(int pid)
   struct proc *p;
 
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = ptable.pidhash[PIDHASH(pid)]; p; p = p->hnext){
     if(p->pid == pid){
+      acquire(PLOCK(p));
       p->killed = 1;
       // Wake process from sleep if necessary.
+      // It leaves its wait queue itself (see sleep).
       if(p->state == SLEEPING)
-        p->state = RUNNABLE;
+        setrunnable(p);
+      release(PLOCK(p));
       release(&ptable.lock);
       return 0;
     }
@@ -484,16 +1026,151 @@ int getPagedOutAmout(struct proc* p){
   return amout;
 }
 
-void updateLap(){
+//PAGEBREAK: 30
+// Load control: a medium-term scheduler, run by CPU 0 every
+// LOADTICKS ticks.  When the paging processes did more than
+// THRASHHIGH swap reads and writes in the last interval, the one
+// that did the most is suspended: it pages out its resident set the
+// next time it returns to user space and sleeps (off the run queues)
+// until paging drops below THRASHLOW, when the process suspended
+// longest is resumed.  At least one paging process stays active.
+// The counts are read without locks; loadlock orders resuming with
+// suspend().
+void
+loadctl(void)
+{
+  struct proc *p, *heavy, *oldest;
+  int io, active;
+
+  io = active = 0;
+  heavy = oldest = 0;
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->pid <= 2 || p->state == UNUSED || p->state == ZOMBIE)
+      continue;
+    io += p->pgio;
+    if(p->suspended){
+      if(oldest == 0 || p->suspendtick < oldest->suspendtick)
+        oldest = p;
+    } else {
+      active++;
+      if(p->pgio > 0 && (heavy == 0 || p->pgio > heavy->pgio))
+        heavy = p;
+    }
+    p->pgio = 0;
+  }
+  if(io > THRASHHIGH && active > 1 && heavy){
+    heavy->suspended = 1;
+    heavy->suspendtick = ticks;
+  } else if(io < THRASHLOW && oldest){
+    acquire(&loadlock);
+    oldest->suspended = 0;
+    wakeup(&oldest->suspended);
+    release(&loadlock);
+  }
+}
+
+// Called on the way back to user space by a process that load
+// control suspended.
+void
+suspend(void)
+{
+  pageOutAll();
+  acquire(&loadlock);
+  while(proc->suspended && !proc->killed)
+    sleep(&proc->suspended, &loadlock);
+  release(&loadlock);
+}
+
+// Give the current process n tickets, its share of the CPU under
+// STRIDE and LOTTERY scheduling relative to the other processes.
+// Children inherit them.  Returns -1 if n is out of range.
+int
+settickets(int n)
+{
+  if(n < 1 || n > MAXTICKETS)
+    return -1;
+  proc->tickets = n;
+  proc->stride = STRIDE1 / n;
+  return 0;
+}
+
+// Restrict the process with pid pid (0 for the current one) to
+// the CPUs in mask, and return its previous mask.  A mask of 0
+// changes nothing.  Returns -1 if there is no such process or mask
+// has no CPU that exists.  Processes not restricted prefer the CPU
+// they last ran on, but may move.
+int
+setaffinity(int pid, int mask)
+{
   struct proc *p;
+  int old;
+
+  if(mask && !(mask & ((1 << ncpu) - 1)))
+    return -1;
+  if(pid == 0)
+    pid = proc->pid;
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if (p->pid > 2 && p->state > 1 && p->state < 5) //proc is either running, runnable or sleeping
-      updateAccessCounters(p); //implemented in vm.c
+  for(p = ptable.pidhash[PIDHASH(pid)]; p; p = p->hnext)
+    if(p->pid == pid)
+      break;
+  if(p == 0){
+    release(&ptable.lock);
+    return -1;
   }
+  acquire(PLOCK(p));
+  old = p->cpumask;
+  if(mask){
+    p->cpumask = mask;
+    // Move it if it is waiting on a CPU it may no longer use.
+    if(p->state == RUNNABLE && !(mask & (1 << p->cpu)) &&
+       runqremove(&runq[p->cpu], p))
+      setrunnable(p);
+  }
+  release(PLOCK(p));
   release(&ptable.lock);
+  // Leave this CPU if it is no longer allowed.
+  if(mask && p == proc && !(mask & (1 << (cpu - cpus))))
+    yield();
+  return old;
 }
 
+// Fill in *st with the scheduler statistics of the process with
+// pid id (what == SS_PROC) or of CPU id (SS_CPU).  The counters
+// are read without locks.  Returns -1 if there is no such one.
+int
+getschedstat(int what, int id, struct schedstat *st)
+{
+  struct proc *p;
+  struct cpu *c;
+
+  memset(st, 0, sizeof(*st));
+  if(what == SS_PROC){
+    acquire(&ptable.lock);
+    for(p = ptable.pidhash[PIDHASH(id)]; p; p = p->hnext)
+      if(p->pid == id)
+        break;
+    if(p){
+      st->nvcsw = p->nvcsw;
+      st->nivcsw = p->nivcsw;
+      st->runticks = p->runticks;
+      st->tickets = p->tickets;
+      memmove(st->lat, p->lat, sizeof(st->lat));
+    }
+    release(&ptable.lock);
+    return p ? 0 : -1;
+  }
+  if(what == SS_CPU && id >= 0 && id < ncpu){
+    c = &cpus[id];
+    st->nswtch = c->nswtch;
+    st->nvcsw = c->nvcsw;
+    st->nivcsw = c->nivcsw;
+    st->runticks = c->nticks - c->idleticks;
+    st->idleticks = c->idleticks;
+    memmove(st->lat, c->lat, sizeof(st->lat));
+    return 0;
+  }
+  return -1;
+}
 
 //PAGEBREAK: 36
 // Print a process listing to console.  For debugging.
@@ -537,7 +1214,29 @@ void procdump(void){
 
     cprintf("\n");
   }
+#if STRIDE || LOTTERY
+  // Each process's share of the tickets held and of the ticks run
+  // by the processes alive now.
+  uint ntickets = 0, nticks = 0;
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->state != UNUSED && p->state != ZOMBIE){
+      ntickets += p->tickets;
+      nticks += p->runticks;
+    }
+  }
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->state != UNUSED && p->state != ZOMBIE && ntickets && nticks)
+      cprintf("pid %d: %d tickets, target %d%%, achieved %d%%\n", p->pid,
+              p->tickets, p->tickets*100/ntickets, p->runticks*100/nticks);
+  }
+#endif
+  for(i = 0; i < ncpu; i++)
+    cprintf("cpu%d: idle %d of %d ticks\n", i, cpus[i].idleticks, cpus[i].nticks);
   cprintf("%d/%d free pages in the system\n",getFreePages(),getTotalPages());
+  kallocstat();
+  slabstat();
+  pcstat();
+  tlbstat();
 
 
 }
@@ -10,6 +10,23 @@ struct cpu {
   volatile uint started;       // Has the CPU started?
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
+  pde_t *pgdir;                // User page table in CR3, 0 if kpgdir
+  volatile int tlbpending;     // Shootdown request not yet handled here
+
+  // TLB shootdown statistics; see tlb.c
+  uint tlbshootdowns;          // Shootdowns sent from this CPU
+  uint tlbipis;                // IPIs sent
+  uint tlbintrs;               // Shootdown requests handled
+  uint tlbcycles;              // TSC cycles spent waiting for acks
+  uint tlbmaxcycles;           // Longest wait
+
+  volatile uint idle;          // Halted in scheduler(), waiting for work
+  uint nticks;                 // Timer ticks taken
+  uint idleticks;              // ... of which with no process running
+  uint nswtch;                 // Switches to a process
+  uint nvcsw;                  // ... after which it slept
+  uint nivcsw;                 // ... after which it was preempted
+  uint lat[NLATBUCKET];        // Run queue waits, see schedstat.h
   
   // Cpu-local storage variables; see below
   struct cpu *cpu;
@@ -17,6 +34,14 @@ struct cpu {
 };
 
 extern struct cpu cpus[NCPU];
+
+// TLB invalidations of one page table collected during one
+// operation and sent to the other CPUs in one shootdown.
+struct tlbbatch {
+  pde_t *pgdir;
+  int n;                       // > TLBFLUSHMAX means flush everything
+  uint va[TLBFLUSHMAX];
+};
 extern int ncpu;
 
 // Per-CPU variables, holding pointers to the
@@ -53,16 +78,45 @@ enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 enum page_struct_state {NOTUSED, USED}; 
 
-// pages struct
+// Swap file slot (see fs.c)
 struct pagecontroller {
   enum page_struct_state state;  
   pde_t* pgdir;
   uint userPageVAddr;
   uint accessCount;
   uint loadOrder;
+  char *mem;                   // the page's contents while exec stages it
 };
 
+// Memory-mapped file region (see mmap.c)
+struct mmapregion {
+  struct file *f;              // Mapped file, 0 if the slot is free
+  uint addr;                   // Page-aligned start address
+  uint len;                    // Length in bytes, page-aligned
+  uint off;                    // File offset mapped at addr
+  int prot;                    // PROT_READ, PROT_WRITE
+  int flags;                   // MAP_SHARED or MAP_PRIVATE
+};
 
+// Resident pages of a process that the pager may evict, as a
+// circular list of frame descriptors (see page.h) ordered by
+// load time: head is the most recently loaded, head->prev the
+// oldest.
+struct lru {
+  struct page *head;
+  int n;
+  int npinned;             // pages that may not be evicted now
+};
+
+
+
+// Paging state of the old image, set aside by exec() while it
+// builds the new one (see execstage in vm.c).
+struct pagingsave {
+  struct lru lru;
+  struct pagecontroller fileCtrlr[MAX_TOTAL_PAGES-MAX_PYSC_PAGES];
+  int npages;
+};
 
 // Per-process state
 struct proc {
@@ -72,6 +126,9 @@ struct proc {
   enum procstate state;        // Process state
   int pid;                     // Process ID
   struct proc *parent;         // Parent process
+  struct proc *children;       // First child
+  struct proc *sibling;        // Next child of the same parent
+  struct proc *hnext;          // Next in pid hash chain or on free list
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
@@ -85,12 +142,37 @@ struct proc {
   //Swap file. must initiate with create swap file
   struct file *swapFile;			//page file
   struct pagecontroller fileCtrlr[MAX_TOTAL_PAGES-MAX_PYSC_PAGES];
-  struct pagecontroller ramCtrlr[MAX_PYSC_PAGES];
-  uint loadOrderCounter; //load/creation
+  struct lru lru;              // resident pages, at most MAX_PYSC_PAGES
+  struct mmapregion mmaps[NMMAP]; // Memory-mapped files
+  uint stackLimit;             // Lowest address the user stack may grow to
+  uint stackBottom;            // Lowest mapped user stack address
+  int npages;                  // Pages in memory or in the swap file, see allocuvm
+  struct proc *rqnext;         // Next on run queue (see proc.c)
+  struct waitq *waitq;         // Wait queue it is on, if any (see sleep)
+  struct proc *wnext, *wprev;  // Neighbours on that wait queue
+  int cpu;                     // Run queue to join: the CPU it last ran on
+  int cpumask;                 // CPUs it may run on, bit i for cpus[i]
+  int tickets;                 // Share of the CPU, see settickets()
+  uint stride;                 // STRIDE1 / tickets
+  uint pass;                   // Virtual time: stride per tick run
+  int prio;                    // Run queue level, 0 highest
+  int nice;                    // Base level, see nice()
+  int ticks;                   // Timer ticks used at this level
+  int pgio;                    // Swap reads and writes since the last loadctl()
+  int suspended;               // Deactivated by loadctl()
+  uint suspendtick;            // When it was deactivated
+  uint64 readytsc;             // TSC when it last became RUNNABLE
+  uint nvcsw;                  // Times it slept
+  uint nivcsw;                 // Times it was preempted
+  uint runticks;               // Timer ticks it was running
+  uint lat[NLATBUCKET];        // Run queue waits, see schedstat.h
 };
 
 // Process memory is laid out contiguously, low addresses first:
 //   text
 //   original data and bss
-//   fixed-size stack
+//   guard page
+//   stack, grown on demand down to the guard page
 //   expandable heap
+//   ...
+//   mmap regions, from MMAPBASE up
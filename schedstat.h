@@ -0,0 +1,17 @@
+// Scheduler statistics, filled in by getschedstat().
+// Needs param.h for NLATBUCKET.
+
+#define SS_PROC 1  // statistics of the process with pid id
+#define SS_CPU  2  // statistics of CPU number id
+
+struct schedstat {
+  uint nswtch;              // Switches to a process (CPU only)
+  uint nvcsw;               // Voluntary switches: slept
+  uint nivcsw;              // Involuntary switches: preempted
+  uint runticks;            // Timer ticks spent running a process
+  uint idleticks;           // Timer ticks with nothing running (CPU only)
+  uint tickets;             // Tickets held (process only)
+  uint lat[NLATBUCKET];     // Waits from RUNNABLE to RUNNING, in TSC
+                            // cycles: lat[0] counts waits under 2^14,
+                            // lat[i] under 2^(14+2i), the last the rest
+};
@@ -0,0 +1,128 @@
+// Tests of the scheduler system calls: nice, getschedstat,
+// setaffinity and settickets.  Kept out of usertests so that its
+// binary still fits in a file system file.
+
+#include "param.h"
+#include "types.h"
+#include "user.h"
+#include "schedstat.h"
+
+// nice() only lowers the base priority level, within its range,
+// and a lowered process still gets to run.
+void
+nicetest(void)
+{
+  int pid;
+  volatile int i;
+
+  printf(1, "nice test\n");
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(nice(0) != 0 || nice(-1) >= 0 || nice(1) != 1 ||
+       nice(100) != NPRIO-1 || nice(-100) >= 0)
+      printf(1, "nice test: wrong level\n");
+    for(i = 0; i < 10000000; i++)
+      ;
+    exit();
+  }
+  wait();
+  printf(1, "nice test ok\n");
+}
+
+// sleeping counts as a voluntary switch, and CPU 0 has run something.
+void
+schedstattest(void)
+{
+  struct schedstat st;
+  int n;
+
+  printf(1, "schedstat test\n");
+  if(getschedstat(SS_PROC, getpid(), &st) < 0){
+    printf(1, "schedstat test: no stats for self\n");
+    exit();
+  }
+  n = st.nvcsw;
+  sleep(1);
+  getschedstat(SS_PROC, getpid(), &st);
+  if(st.nvcsw <= n){
+    printf(1, "schedstat test: sleep not counted\n");
+    exit();
+  }
+  if(getschedstat(SS_CPU, 0, &st) < 0 || st.nswtch == 0 ||
+     getschedstat(SS_CPU, NCPU, &st) >= 0){
+    printf(1, "schedstat test: bad cpu stats\n");
+    exit();
+  }
+  printf(1, "schedstat test ok\n");
+}
+
+// a process pinned to CPU 0 keeps running, and children inherit the mask.
+void
+affinitytest(void)
+{
+  int all, pid;
+
+  printf(1, "affinity test\n");
+  all = setaffinity(0, 0);
+  if(all <= 0 || setaffinity(0, 1) != all || setaffinity(0, 0) != 1 ||
+     setaffinity(0, 1 << NCPU) >= 0){
+    printf(1, "affinity test: wrong mask\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(setaffinity(0, 0) != 1)
+      printf(1, "affinity test: mask not inherited\n");
+    exit();
+  }
+  wait();
+  setaffinity(0, all);
+  printf(1, "affinity test ok\n");
+}
+
+// tickets stay in range and are inherited by children.
+void
+ticketstest(void)
+{
+  struct schedstat st;
+  int pid;
+
+  printf(1, "tickets test\n");
+  if(settickets(0) >= 0 || settickets(MAXTICKETS+1) >= 0 || settickets(50) < 0){
+    printf(1, "tickets test: range not checked\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(getschedstat(SS_PROC, getpid(), &st) < 0 || st.tickets != 50)
+      printf(1, "tickets test: tickets not inherited\n");
+    exit();
+  }
+  wait();
+  settickets(NTICKETS);
+  printf(1, "tickets test ok\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  printf(1, "schedtests starting\n");
+  nicetest();
+  schedstattest();
+  affinitytest();
+  ticketstest();
+  printf(1, "schedtests ok\n");
+  exit();
+}
@@ -0,0 +1,233 @@
+// Slab allocator for small kernel objects.
+//
+// A slab cache hands out objects of one size.  Objects are carved
+// out of slabs, each a single page obtained from kalloc() with a
+// struct slab header at its start; the header of an object's slab
+// is found by rounding the object's address down to a page.  Slabs
+// with free objects sit on the cache's partial list; a slab whose
+// objects are all free again goes back to kalloc(), unless it is the
+// cache's only partial slab.
+//
+// Each CPU keeps a magazine of up to SLABMAG free objects per cache,
+// used with only interrupts disabled.  The cache lock is taken only
+// to move SLABBATCH objects between a magazine and the slabs.
+//
+// A constructor, if given, runs once on every object when its slab
+// is created.  Objects are expected to be freed in their constructed
+// state, so it is not run again on reuse.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "proc.h"
+
+struct slab {
+  struct slab *next;        // on the cache's partial list
+  struct slabcache *cache;
+  int inuse;                // objects handed out (or in a magazine)
+  void **free;              // free objects in this slab
+};
+
+struct slabcache {
+  char *name;
+  uint size;                // object size, rounded up
+  int perslab;              // objects per slab
+  void (*ctor)(void*);
+  struct spinlock lock;
+  struct slab *partial;     // slabs with free objects
+  int nslabs;
+  struct {
+    int n;
+    void *obj[SLABMAG];
+  } mag[NCPU];              // per-CPU magazines, indexed like cpus[]
+};
+
+static struct {
+  struct spinlock lock;
+  struct slabcache cache[NSLABCACHE];
+  int n;
+} slabs;
+
+void
+slabinit(void)
+{
+  initlock(&slabs.lock, "slabs");
+}
+
+// Create a cache of objects of size bytes, each initialized once
+// by ctor (which may be 0).  Panics if no cache is left or the
+// objects do not fit in a slab.
+struct slabcache*
+slabcreate(char *name, uint size, void (*ctor)(void*))
+{
+  struct slabcache *sc;
+
+  size = (size + 3) & ~3;
+  if(size < sizeof(void*) || size > PGSIZE - sizeof(struct slab))
+    panic("slabcreate: size");
+  acquire(&slabs.lock);
+  if(slabs.n == NSLABCACHE)
+    panic("slabcreate: too many caches");
+  sc = &slabs.cache[slabs.n++];
+  release(&slabs.lock);
+
+  sc->name = name;
+  sc->size = size;
+  sc->perslab = (PGSIZE - sizeof(struct slab)) / size;
+  sc->ctor = ctor;
+  initlock(&sc->lock, name);
+  return sc;
+}
+
+// Allocate and construct a new slab for sc.
+// Called without sc->lock, since kalloc() may reclaim memory.
+static struct slab*
+slabgrow(struct slabcache *sc)
+{
+  struct slab *s;
+  char *o;
+  int i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = sc;
+  s->inuse = 0;
+  s->free = 0;
+  o = (char*)(s + 1);
+  for(i = 0; i < sc->perslab; i++, o += sc->size){
+    if(sc->ctor)
+      sc->ctor(o);
+    *(void**)o = s->free;
+    s->free = (void**)o;
+  }
+  return s;
+}
+
+// Move up to SLABBATCH free objects from the slabs of sc to the
+// magazine of this CPU, growing the cache if it has none.
+// Called with interrupts off.
+static void
+slabfill(struct slabcache *sc, int c)
+{
+  struct slab *s;
+  void **o;
+
+  acquire(&sc->lock);
+  if(sc->partial == 0){
+    release(&sc->lock);
+    if((s = slabgrow(sc)) == 0)
+      return;
+    acquire(&sc->lock);
+    s->next = sc->partial;
+    sc->partial = s;
+    sc->nslabs++;
+  }
+  while(sc->mag[c].n < SLABBATCH && (s = sc->partial) != 0){
+    o = s->free;
+    s->free = (void**)*o;
+    s->inuse++;
+    sc->mag[c].obj[sc->mag[c].n++] = o;
+    if(s->free == 0)
+      sc->partial = s->next;
+  }
+  release(&sc->lock);
+}
+
+// Return obj to its slab.  Caller holds sc->lock.  Returns the
+// slab if it became empty and should be given back to kalloc().
+static struct slab*
+slabput(struct slabcache *sc, void *obj)
+{
+  struct slab *s, **pp;
+
+  s = (struct slab*)PGROUNDDOWN((uint)obj);
+  if(s->cache != sc || s->inuse <= 0)
+    panic("slabfree");
+  if(s->free == 0){
+    s->next = sc->partial;
+    sc->partial = s;
+  }
+  *(void**)obj = s->free;
+  s->free = (void**)obj;
+  if(--s->inuse > 0 || (sc->partial == s && s->next == 0))
+    return 0;
+  for(pp = &sc->partial; *pp; pp = &(*pp)->next){
+    if(*pp == s){
+      *pp = s->next;
+      break;
+    }
+  }
+  sc->nslabs--;
+  return s;
+}
+
+// Move SLABBATCH objects from this CPU's magazine back to their
+// slabs.  Called with interrupts off.
+static void
+slabdrain(struct slabcache *sc, int c)
+{
+  struct slab *s, *empty;
+  int i;
+
+  empty = 0;
+  acquire(&sc->lock);
+  for(i = 0; i < SLABBATCH && sc->mag[c].n > 0; i++){
+    if((s = slabput(sc, sc->mag[c].obj[--sc->mag[c].n])) != 0){
+      s->next = empty;
+      empty = s;
+    }
+  }
+  release(&sc->lock);
+  while((s = empty) != 0){
+    empty = s->next;
+    kfree((char*)s);
+  }
+}
+
+// Allocate an object from sc.  Returns 0 if out of memory.
+void*
+slaballoc(struct slabcache *sc)
+{
+  void *obj;
+  int c;
+
+  obj = 0;
+  pushcli();
+  c = cpu - cpus;
+  if(sc->mag[c].n == 0)
+    slabfill(sc, c);
+  if(sc->mag[c].n > 0)
+    obj = sc->mag[c].obj[--sc->mag[c].n];
+  popcli();
+  return obj;
+}
+
+// Free an object returned by slaballoc().
+void
+slabfree(void *obj)
+{
+  struct slabcache *sc;
+  int c;
+
+  sc = ((struct slab*)PGROUNDDOWN((uint)obj))->cache;
+  pushcli();
+  c = cpu - cpus;
+  if(sc->mag[c].n == SLABMAG)
+    slabdrain(sc, c);
+  sc->mag[c].obj[sc->mag[c].n++] = obj;
+  popcli();
+}
+
+// Print the size of every cache.  For procdump.
+void
+slabstat(void)
+{
+  struct slabcache *sc;
+
+  for(sc = slabs.cache; sc < &slabs.cache[slabs.n]; sc++)
+    cprintf("slab %s: %d bytes, %d slabs of %d\n",
+            sc->name, sc->size, sc->nslabs, sc->perslab);
+}
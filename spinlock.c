@@ -31,8 +31,10 @@ acquire(struct spinlock *lk)
   // The xchg is atomic.
   // It also serializes, so that reads after acquire are not
   // reordered before it. 
+  // Keep answering TLB shootdowns while spinning with interrupts
+  // off, in case the holder is waiting for this CPU (see tlb.c).
   while(xchg(&lk->locked, 1) != 0)
-    ;
+    tlbpoll();
 
   // Record info about lock acquisition for debugging.
   lk->cpu = cpu;
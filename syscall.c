@@ -19,6 +19,8 @@ fetchint(uint addr, int *ip)
 {
   if(addr >= proc->sz || addr+4 > proc->sz)
     return -1;
+  if(uvmprefault(addr, 4) < 0)
+    return -1;
   *ip = *(int*)(addr);
   return 0;
 }
@@ -35,9 +37,12 @@ fetchstr(uint addr, char **pp)
     return -1;
   *pp = (char*)addr;
   ep = (char*)proc->sz;
-  for(s = *pp; s < ep; s++)
+  for(s = *pp; s < ep; s++){
+    if((s == *pp || (uint)s % PGSIZE == 0) && uvmprefault((uint)s, 1) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
+  }
   return -1;
 }
 
@@ -50,15 +55,20 @@ argint(int n, int *ip)
 
 // Fetch the nth word-sized system call argument as a pointer
 // to a block of memory of size n bytes.  Check that the pointer
-// lies within the process address space.
+// lies within the process address space, and that the process
+// may write it if write is set (the kernel will store into it).
 int
-argptr(int n, char **pp, int size)
+argptr(int n, char **pp, int size, int write)
 {
   int i;
   
   if(argint(n, &i) < 0)
     return -1;
-  if((uint)i >= proc->sz || (uint)i+size > proc->sz)
+  if((uint)i >= proc->sz || (uint)i+size > proc->sz){
+    // Not in the heap: allow a buffer inside a mapped file.
+    if((uint)i < MMAPBASE || mmapcheck(i, size, write) < 0)
+      return -1;
+  } else if(uvmprefault(i, size) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
@@ -98,6 +108,13 @@ extern int sys_unlink(void);
 extern int sys_wait(void);
 extern int sys_write(void);
 extern int sys_uptime(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_msync(void);
+extern int sys_nice(void);
+extern int sys_getschedstat(void);
+extern int sys_setaffinity(void);
+extern int sys_settickets(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -121,6 +138,13 @@ static int (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_msync]   sys_msync,
+[SYS_nice]    sys_nice,
+[SYS_getschedstat] sys_getschedstat,
+[SYS_setaffinity] sys_setaffinity,
+[SYS_settickets] sys_settickets,
 };
 
 void
@@ -131,6 +155,7 @@ syscall(void)
   num = proc->tf->eax;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
     proc->tf->eax = syscalls[num]();
+    uvmunpin();
   } else {
     cprintf("%d %s: unknown sys call %d\n",
             proc->pid, proc->name, num);
@@ -20,3 +20,10 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_mmap   22
+#define SYS_munmap 23
+#define SYS_msync  24
+#define SYS_nice   25
+#define SYS_getschedstat 26
+#define SYS_setaffinity 27
+#define SYS_settickets 28
@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "schedstat.h"
 
 int
 sys_fork(void)
@@ -88,3 +89,48 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// lower the scheduling base priority by the given number of levels.
+int
+sys_nice(void)
+{
+  int incr;
+
+  if(argint(0, &incr) < 0)
+    return -1;
+  return nice(incr);
+}
+
+// copy scheduler statistics of a process or CPU to user space.
+int
+sys_getschedstat(void)
+{
+  int what, id;
+  struct schedstat *st;
+
+  if(argint(0, &what) < 0 || argint(1, &id) < 0 || argptr(2, (void*)&st, sizeof(*st), 1) < 0)
+    return -1;
+  return getschedstat(what, id, st);
+}
+
+// restrict a process to a set of CPUs; returns the old set.
+int
+sys_setaffinity(void)
+{
+  int pid, mask;
+
+  if(argint(0, &pid) < 0 || argint(1, &mask) < 0)
+    return -1;
+  return setaffinity(pid, mask);
+}
+
+// set the number of tickets of the calling process.
+int
+sys_settickets(void)
+{
+  int n;
+
+  if(argint(0, &n) < 0)
+    return -1;
+  return settickets(n);
+}
@@ -0,0 +1,215 @@
+// TLB shootdown.
+//
+// Changing or removing a PTE must also remove any copy of it that
+// is cached in a TLB.  The CPU making the change invalidates its
+// own TLB with invlpg; other CPUs that have the same page table
+// loaded in CR3 are sent a T_TLBFLUSH interrupt and do the same.
+// Each CPU records the user page table it has loaded in
+// cpu->pgdir (switchuvm sets it, the scheduler clears it), so
+// only those CPUs are interrupted.  A CPU that loads the page
+// table later gets a fresh TLB from the CR3 load.
+//
+// Callers collect the pages changed by one operation in a
+// struct tlbbatch and send them together with tlbflush();
+// tlbinval() and tlbinvalrange() are shorthands for one page
+// and for a range.
+//
+// Kernel mappings are global (PTE_G) and survive CR3 loads; a
+// batch with a null pgdir (tlbflushkernel) flushes them on every CPU.
+//
+// One shootdown is in flight at a time.  The initiator holds
+// shootdown.locked and spins with interrupts off until every
+// target has cleared its cpu->tlbpending.  A target that is itself
+// spinning with interrupts off (for a spinlock, or for the
+// shootdown lock) would never take the interrupt, so those loops
+// call tlbpoll() to handle a pending request by polling.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "traps.h"
+#include "proc.h"
+
+static struct {
+  uint locked;
+  struct tlbbatch *batch;   // request being sent
+} shootdown;
+
+void
+tlbbatchinit(struct tlbbatch *b, pde_t *pgdir)
+{
+  b->pgdir = pgdir;
+  b->n = 0;
+}
+
+// Record that the PTE for va in pgdir changed.  A batch holds
+// the pages of one page table; adding a page of another one
+// sends the batch first.
+void
+tlbbatchadd(struct tlbbatch *b, pde_t *pgdir, uint va)
+{
+  if(b->pgdir != pgdir){
+    tlbflush(b);
+    b->pgdir = pgdir;
+  }
+  if(b->n < TLBFLUSHMAX)
+    b->va[b->n] = PGROUNDDOWN(va);
+  if(b->n <= TLBFLUSHMAX)
+    b->n++;
+}
+
+// Apply b to this CPU's TLB, if its page table is loaded here.
+static void
+tlblocal(struct tlbbatch *b)
+{
+  uint cr4;
+  int i;
+
+  if(b->pgdir == 0){
+    // Toggling CR4_PGE flushes global entries too.
+    cr4 = rcr4();
+    lcr4(cr4 & ~CR4_PGE);
+    lcr4(cr4);
+    return;
+  }
+  if(rcr3() != v2p(b->pgdir))
+    return;
+  if(b->n > TLBFLUSHMAX){
+    lcr3(v2p(b->pgdir));
+    return;
+  }
+  for(i = 0; i < b->n; i++)
+    invlpg((void*)b->va[i]);
+}
+
+// Handle a shootdown request sent to this CPU, if there is one.
+// Interrupts must be off.
+void
+tlbpoll(void)
+{
+  if(!cpu->tlbpending)
+    return;
+  tlblocal(shootdown.batch);
+  cpu->tlbintrs++;
+  xchg((uint*)&cpu->tlbpending, 0);
+}
+
+// T_TLBFLUSH interrupt.
+void
+tlbintr(void)
+{
+  tlbpoll();
+}
+
+// Is c a CPU other than this one that may cache entries of b?
+static int
+tlbtarget(struct cpu *c, struct tlbbatch *b)
+{
+  if(c == cpu || !c->started)
+    return 0;
+  return b->pgdir == 0 || c->pgdir == b->pgdir;
+}
+
+// Invalidate the pages in b on this CPU and on every other CPU
+// that has b->pgdir loaded, then empty b.
+void
+tlbflush(struct tlbbatch *b)
+{
+  struct cpu *c;
+  uint t;
+  int sent;
+
+  if(b->n == 0)
+    return;
+  pushcli();
+  tlblocal(b);
+  if(ncpu > 1 && lapic){
+    // The PTE stores must be visible before cpu->pgdir is read,
+    // or a CPU that is just loading b->pgdir could be missed.
+    __sync_synchronize();
+    for(c = cpus; c < &cpus[ncpu]; c++)
+      if(tlbtarget(c, b))
+        break;
+    if(c < &cpus[ncpu]){
+      t = rdtsc();
+      while(xchg(&shootdown.locked, 1) != 0)
+        tlbpoll();
+      shootdown.batch = b;
+      sent = 0;
+      for(c = cpus; c < &cpus[ncpu]; c++){
+        if(tlbtarget(c, b)){
+          c->tlbpending = 1;
+          lapicipi(c->id, T_TLBFLUSH);
+          sent++;
+        }
+      }
+      for(c = cpus; c < &cpus[ncpu]; c++)
+        while(c->tlbpending)
+          ;
+      xchg(&shootdown.locked, 0);
+      t = rdtsc() - t;
+      cpu->tlbshootdowns++;
+      cpu->tlbipis += sent;
+      cpu->tlbcycles += t;
+      if(t > cpu->tlbmaxcycles)
+        cpu->tlbmaxcycles = t;
+    }
+  }
+  popcli();
+  b->n = 0;
+}
+
+// Invalidate the TLB entries for user address va of pgdir.
+void
+tlbinval(pde_t *pgdir, uint va)
+{
+  struct tlbbatch b;
+
+  tlbbatchinit(&b, pgdir);
+  tlbbatchadd(&b, pgdir, va);
+  tlbflush(&b);
+}
+
+// Invalidate the TLB entries for the user range [start, end) of
+// pgdir: page by page for small ranges, a CR3 reload for large ones.
+void
+tlbinvalrange(pde_t *pgdir, uint start, uint end)
+{
+  struct tlbbatch b;
+  uint a;
+
+  tlbbatchinit(&b, pgdir);
+  for(a = PGROUNDDOWN(start); a < end && b.n <= TLBFLUSHMAX; a += PGSIZE)
+    tlbbatchadd(&b, pgdir, a);
+  tlbflush(&b);
+}
+
+// Flush every TLB entry, global kernel mappings included, on all
+// CPUs.  Needed after changing a mapping set up by setupkvm().
+void
+tlbflushkernel(void)
+{
+  struct tlbbatch b;
+
+  tlbbatchinit(&b, 0);
+  b.n = TLBFLUSHMAX + 1;
+  tlbflush(&b);
+}
+
+// Print shootdown statistics.  For procdump.
+void
+tlbstat(void)
+{
+  struct cpu *c;
+
+  for(c = cpus; c < &cpus[ncpu]; c++){
+    cprintf("cpu%d tlb: %d shootdowns, %d ipis, %d handled, ",
+            c->id, c->tlbshootdowns, c->tlbipis, c->tlbintrs);
+    cprintf("avg %d max %d cycles\n",
+            c->tlbshootdowns ? c->tlbcycles / c->tlbshootdowns : 0,
+            c->tlbmaxcycles);
+  }
+}
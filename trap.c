@@ -47,15 +47,35 @@ void trap(struct trapframe *tf){
   }
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
+    cpu->nticks++;
+    if(proc)
+      proc->runticks++;
+    else
+      cpu->idleticks++;
     if(cpu->id == 0){
       acquire(&tickslock);
       ticks++;
       wakeup(&ticks);
       release(&tickslock);
-      #if LAP
-        updateLap(); //defined in proc.c due to ptable usage
-      #endif
+      if(ticks % BOOSTTICKS == 0)
+        priboost();
+      if(ticks % LOADTICKS == 0)
+        loadctl();
     }
+    #if LAP
+      // Each CPU ages the pages of the process it interrupted.
+      // Only from user mode: in the kernel it may be changing its lru.
+      if(proc && proc->pid > 2 && (tf->cs&3) == DPL_USER)
+        updateAccessCounters(proc);
+    #endif
+    lapiceoi();
+    break;
+  case T_TLBFLUSH:
+    tlbintr();
+    lapiceoi();
+    break;
+  case T_WAKEUP:
+    // Only needed to leave hlt in scheduler().
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_IDE:
@@ -82,11 +102,11 @@ void trap(struct trapframe *tf){
 
 
   case T_PGFLT:
-    if (proc != 0 && (tf->cs&3) == 3 &&pageIsInFile(rcr2(), proc->pgdir)){
-      if (getPageFromFile(rcr2())){
-        break;
-      }
-    }
+    // A user page that is paged out or not touched yet.  System
+    // calls prefault and pin their arguments (see uvmprefault), so
+    // the kernel itself never takes this fault.
+    if (proc != 0 && (tf->cs&3) == DPL_USER && uvmfault(rcr2()))
+      break;
    
   //PAGEBREAK: 13
   default:
@@ -110,9 +130,16 @@ void trap(struct trapframe *tf){
   if(proc && proc->killed && (tf->cs&3) == DPL_USER)
     exit();
 
-  // Force process to give up CPU on clock tick.
+  // Leave the CPU to other processes if load control
+  // deactivated this one.
+  if(proc && proc->suspended && (tf->cs&3) == DPL_USER)
+    suspend();
+
+  // Force process to give up CPU on clock tick once its time
+  // slice is used up (see schedtick).
   // If interrupts were on while locks held, would need to check nlock.
-  if(proc && proc->state == RUNNING && tf->trapno == T_IRQ0+IRQ_TIMER)
+  if(proc && proc->state == RUNNING && tf->trapno == T_IRQ0+IRQ_TIMER
+     && schedtick())
     yield();
 
   // Check if the process has been killed since we yielded
@@ -1,5 +1,6 @@
 struct stat;
 struct rtcdate;
+struct schedstat;
 
 // system calls
 int fork(void);
@@ -23,6 +24,13 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int msync(void*, int);
+int nice(int);
+int getschedstat(int, int, struct schedstat*);
+int setaffinity(int, int);
+int settickets(int);
 
 // ulib.c
 int stat(char*, struct stat*);
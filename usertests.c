@@ -1546,6 +1546,137 @@ sbrktest(void)
   printf(stdout, "sbrk test OK\n");
 }
 
+int
+stackdepth(int n)
+{
+  char frame[512];
+
+  frame[0] = n;
+  frame[sizeof(frame)-1] = n;
+  if(n == 0)
+    return 0;
+  return stackdepth(n - 1) + frame[0] - frame[sizeof(frame)-1] + 1;
+}
+
+// read() into stack pages the program has not touched yet.
+int
+stackread(void)
+{
+  char b[5*4096];
+  int fd, n;
+
+  if((fd = open("README", 0)) < 0)
+    return -1;
+  n = read(fd, b, sizeof(b));
+  close(fd);
+  return n;
+}
+
+// the user stack grows on demand, but not past its limit.
+void
+stacktest(void)
+{
+  int pid;
+
+  printf(stdout, "stack test\n");
+  if(stackread() <= 0){
+    printf(stdout, "stack test: read into new stack pages failed\n");
+    exit();
+  }
+  if(stackdepth(40) != 40){
+    printf(stdout, "stack test: wrong result\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    stackdepth(1000000);
+    printf(stdout, "stack test: unbounded recursion not stopped\n");
+    exit();
+  }
+  wait();
+  printf(stdout, "stack test ok\n");
+}
+
+// mapped file pages fault in from the file, and MAP_SHARED
+// writes reach the file through msync/munmap.
+void
+mmaptest(void)
+{
+  int fd, i, n;
+  char *p;
+
+  printf(stdout, "mmap test\n");
+  unlink("mmapfile");
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "mmap: create failed\n");
+    exit();
+  }
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = 'a' + i % 26;
+  if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf(stdout, "mmap: write failed\n");
+    exit();
+  }
+
+  p = mmap(0, sizeof(buf), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    printf(stdout, "mmap failed\n");
+    exit();
+  }
+  for(i = 0; i < sizeof(buf); i++){
+    if(p[i] != 'a' + i % 26){
+      printf(stdout, "mmap: wrong data at %d\n", i);
+      exit();
+    }
+  }
+  p[0] = 'X';
+  p[4096] = 'Y';
+  if(msync(p, sizeof(buf)) < 0 || munmap(p, sizeof(buf)) < 0){
+    printf(stdout, "mmap: msync/munmap failed\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("mmapfile", O_RDONLY);
+  n = read(fd, buf, sizeof(buf));
+  if(n != sizeof(buf) || buf[0] != 'X' || buf[4096] != 'Y'){
+    printf(stdout, "mmap: shared write not in file\n");
+    exit();
+  }
+
+  // a private mapping may be used as a system call buffer,
+  // including pages the program has not touched
+  p = mmap(0, sizeof(buf), PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1){
+    printf(stdout, "mmap private failed\n");
+    exit();
+  }
+  p[1] = 'Z';
+  close(fd);
+  fd = open("mmapfile", O_RDWR);
+  if(write(fd, p, 2) != 2 || write(fd, p + 4096, 4096) != 4096){
+    printf(stdout, "mmap: write from mapping failed\n");
+    exit();
+  }
+  munmap(p, sizeof(buf));
+
+  // the kernel does not store into a read-only mapping
+  p = mmap(0, sizeof(buf), PROT_READ, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1 || read(fd, p, 1) >= 0){
+    printf(stdout, "mmap: read into read-only mapping\n");
+    exit();
+  }
+  munmap(p, sizeof(buf));
+  close(fd);
+  unlink("mmapfile");
+  printf(stdout, "mmap test ok\n");
+}
+
 void
 validateint(int *p)
 {
@@ -1725,6 +1856,8 @@ main(int argc, char *argv[])
   bigargtest();
   bsstest();
   sbrktest();
+  mmaptest();
+  stacktest();
   validatetest();
 
   opentest();
@@ -5,6 +5,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "page.h"
 #include "elf.h"
 
 extern char data[];  // defined by kernel.ld
@@ -42,19 +43,28 @@ seginit(void)
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address (in u.m) va.  If alloc!=0,
 // create any required page table pages.
-static pte_t * walkpgdir(pde_t *pgdir, const void *va, int alloc){
+// A 4MB user page covering va has no PTE; if alloc!=0 it is first
+// split into 1024 4KB PTEs that map the same frame.  4MB kernel
+// pages are shared by every page table and are never split.
+pte_t * walkpgdir(pde_t *pgdir, const void *va, int alloc){
   pde_t *pde;
   pte_t *pgtab;
+  int i;
 
   pde = &pgdir[PDX(va)]; //PDE index in page directory (0 to 1023 + FLAGS)
-  if(*pde & PTE_P){      //Present bit is on in PDE
+  if(*pde & PTE_PS){     //4MB page
+    if(!alloc || (uint)va >= KERNBASE || (pgtab = (pte_t*)kalloc()) == 0)
+      return 0;
+    for(i = 0; i < NPTENTRIES; i++)
+      pgtab[i] = (PTE_ADDR(*pde) + i*PGSIZE) | (PTE_FLAGS(*pde) & ~PTE_PS);
+    *pde = v2p(pgtab) | PTE_P | PTE_W | PTE_U;
+  } else if(*pde & PTE_P){      //Present bit is on in PDE
     pgtab = (pte_t*)p2v(PTE_ADDR(*pde)); //pgtab = virtual address to beginning of page table
 
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0) //if alloc != 0, try to create new page table
+    // kalloc_zeroed: make sure all those PTE_P bits are zero.
+    if(!alloc || (pgtab = (pte_t*)kalloc_zeroed()) == 0) //if alloc != 0, try to create new page table
       return 0; //page table (PDE) doesn't exist or kalloc failed
-    // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table 
     // entries, if necessary.
@@ -67,7 +77,16 @@ static pte_t * walkpgdir(pde_t *pgdir, const void *va, int alloc){
 // Create PTEs for virtual addresses starting at va (va in U.M) that refer to
 // physical addresses starting at pa. va and size might not
 // be page-aligned.
-static int mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm){
+// Record that the user page va of pgdir maps the frame at pa.
+static void rmapset(uint pa, pde_t *pgdir, uint va){
+  struct page *pg = pa2page(pa);
+
+  pg->pgdir = pgdir;
+  pg->va = va;
+  pg->flags |= PG_MAPPED;
+}
+
+int mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm){
   char *a, *last;
   pte_t *pte;
   
@@ -79,6 +98,8 @@ static int mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm){
     if(*pte & PTE_P)
       panic("remap");         //PTE was already initialized for some reason
     *pte = pa | perm | PTE_P; //adds page physical address, flags, present bit
+    if((perm & PTE_U) && pa < PHYSTOP)
+      rmapset(pa, pgdir, (uint)a);
     if(a == last)
       break;
     a += PGSIZE;
@@ -104,12 +125,21 @@ static int mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm){
 //                                  rw data + free physical memory
 //   0xfe000000..0: mapped direct (devices such as ioapic)
 //
+// The kernel ranges use 4MB pages wherever they are 4MB-aligned
+// (see mapkvm), so most of them need no page table pages.  The
+// kernel half is built once, in kpgdir, by kvmalloc(); setupkvm()
+// copies its directory entries, so the few kernel page table pages
+// are shared by every page table and freevm() leaves them alone.
+//
 // The kernel allocates physical memory for its heap and for user memory
 // between V2P(end) and the end of physical memory (PHYSTOP)
 // (directly addressable from end..P2V(PHYSTOP)).
 
 // This table defines the kernel's mappings, which are present in
-// every process's page table.
+// every process's page table.  They are identical in every page
+// table, so they are mapped PTE_G: with CR4_PGE set (entry.S) their
+// TLB entries survive the CR3 load in switchuvm().  Changing one of
+// them requires tlbflushkernel().
 static struct kmap {
   void *virt;
   uint phys_start;
@@ -122,29 +152,56 @@ static struct kmap {
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
-// Set up kernel part of a page table.
+// Map the kernel range [va, va+size) to [pa, pa+size), using 4MB
+// pages wherever va and pa are 4MB-aligned and a whole 4MB is left.
+static int mapkvm(pde_t *pgdir, char *va, uint size, uint pa, int perm){
+  uint n;
+
+  while(size > 0){
+    if((uint)va % LARGEPGSIZE == 0 && pa % LARGEPGSIZE == 0 && size >= LARGEPGSIZE){
+      pgdir[PDX(va)] = pa | perm | PTE_P | PTE_PS | PTE_G;
+      n = LARGEPGSIZE;
+    } else {
+      n = LARGEPGSIZE - (uint)va % LARGEPGSIZE; //up to the next 4MB boundary
+      if(n > size)
+        n = size;
+      if(mappages(pgdir, va, n, pa, perm | PTE_G) < 0)
+        return -1;
+    }
+    va += n;
+    pa += n;
+    size -= n;
+  }
+  return 0;
+}
+
+// Set up kernel part of a page table, sharing kpgdir's.
 pde_t* setupkvm(void){
   pde_t *pgdir;
-  struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kalloc_zeroed()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
-  if (p2v(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++){
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start, (uint)k->phys_start, k->perm) < 0)
-      return 0;
-  }
+  memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+          (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
   return pgdir;
 }
 
 // Allocate one page table for the machine for the kernel address
-// space for scheduler processes.
+// space for scheduler processes.  Its kernel half is the one
+// every other page table shares.
 void
 kvmalloc(void)
 {
-  kpgdir = setupkvm();
+  struct kmap *k;
+
+  if (p2v(PHYSTOP) > (void*)DEVSPACE)
+    panic("PHYSTOP too high");
+  if((kpgdir = (pde_t*)kalloc_zeroed()) == 0)
+    panic("kvmalloc");
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++){
+    if(mapkvm(kpgdir, k->virt, k->phys_end - k->phys_start, (uint)k->phys_start, k->perm) < 0)
+      panic("kvmalloc");
+  }
   switchkvm();
 }
 
@@ -168,6 +225,7 @@ switchuvm(struct proc *p)
   ltr(SEG_TSS << 3);
   if(p->pgdir == 0)
     panic("switchuvm: no pgdir");
+  cpu->pgdir = p->pgdir;  // before CR3, so shootdowns see it (tlb.c)
   lcr3(v2p(p->pgdir));  // switch to new address space
   popcli();
 }
@@ -192,20 +250,19 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 int
 loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
 {
-  uint i, pa, n;
-  pte_t *pte;
+  uint i, n;
+  char *ka;
 
   if((uint) addr % PGSIZE != 0)
     panic("loaduvm: addr must be page aligned");
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, addr+i, 0)) == 0)
+    if((ka = uva2ka(pgdir, addr+i)) == 0) //also finds pages inside a 4MB page
       panic("loaduvm: address should exist");
-    pa = PTE_ADDR(*pte);
     if(sz - i < PGSIZE)
       n = sz - i;
     else
       n = PGSIZE;
-    if(readi(ip, p2v(pa), offset+i, n) != n)
+    if(readi(ip, ka, offset+i, n) != n)
       return -1;
   }
   return 0;
@@ -227,7 +284,7 @@ void fixPagedOutPTE(int userPageVAddr, pde_t * pgdir){
   *pte |= PTE_PG;
   *pte &= ~PTE_P;
   *pte &= PTE_FLAGS(*pte); //clear junk physical address
-  lcr3(v2p(proc->pgdir)); //refresh CR3 register
+  tlbinval(pgdir, userPageVAddr);
 }
 
 //This method cannot be replaced with mappages because mappages cannot turn off PTE_PG bit
@@ -238,161 +295,418 @@ void fixPagedInPTE(int userPageVAddr, int pagePAddr, pde_t * pgdir){
     panic("PTE of swapped page is missing");
   if (*pte & PTE_P)
   	panic("PAGE IN REMAP!");
-  *pte |= PTE_P | PTE_W | PTE_U;      //Turn on needed bits
+  *pte |= PTE_P | PTE_W | PTE_U | PTE_D; //Turn on needed bits; dirty, as the swap file had the only copy
   *pte &= ~PTE_PG;    								//Turn off inFile bit
   *pte |= pagePAddr;  								//Map PTE to the new Page
-  lcr3(v2p(proc->pgdir)); //refresh CR3 register
+  rmapset(pagePAddr, pgdir, userPageVAddr);
+  tlbinval(pgdir, userPageVAddr);
 }
 
 int pageIsInFile(int userPageVAddr, pde_t * pgdir) {
   pte_t *pte;
+  if((uint)userPageVAddr >= KERNBASE)
+    return 0;
   pte = walkpgdir(pgdir, (char *)userPageVAddr, 0);
+  if(!pte) //uninitialized page table
+    return 0;
   return (*pte & PTE_PG); //PAGE IS IN FILE
 }
 
 
 
-int getLIFO(){
-  int i; 
-  int pageIndex = -1;
-  uint loadOrder = 0;
+//The pager keeps the resident pages of each paged process on its LRU
+//list (struct lru in proc.h), linked through their frame descriptors
+//(struct page in page.h), most recently loaded first.  The frame's
+//reverse map tells which pgdir and address a victim is mapped at.
+
+//Insert pg as the most recently loaded page of l.
+static void lrupush(struct lru *l, struct page *pg){
+  if(pg->lru)
+    panic("lrupush");
+  if(l->head){
+    pg->next = l->head;
+    pg->prev = l->head->prev;
+    l->head->prev->next = pg;
+    l->head->prev = pg;
+  } else
+    pg->next = pg->prev = pg;
+  l->head = pg;
+  l->n++;
+  pg->lru = l;
+}
 
-  for (i = 0; i < MAX_PYSC_PAGES; i++) {
-    if (proc->ramCtrlr[i].state == USED && proc->ramCtrlr[i].loadOrder > loadOrder) {
-        loadOrder = proc->ramCtrlr[i].loadOrder;
-        pageIndex = i;          
-    }
-  }
-  return pageIndex;
-}
-
-  int getSCFIFO(){
-    pte_t * pte;
-    int i = 0;
-    int pageIndex;
-    uint loadOrder;
-  recheck:
-    pageIndex = -1;
-    loadOrder = 0xFFFFFFFF;
-    for (i = 0; i < MAX_PYSC_PAGES; i++) {
-      if (proc->ramCtrlr[i].state == USED && proc->ramCtrlr[i].loadOrder <= loadOrder){
-        pageIndex = i;
-        loadOrder = proc->ramCtrlr[i].loadOrder;
-      }
-    }
-    pte = walkpgdir(proc->ramCtrlr[pageIndex].pgdir, (char*)proc->ramCtrlr[pageIndex].userPageVAddr,0);
-    if (*pte & PTE_A) {
-      *pte &= ~PTE_A; // turn off PTE_A flag
-       proc->ramCtrlr[pageIndex].loadOrder = proc->loadOrderCounter++;
-       goto recheck;
-    }
-    return pageIndex;
+//Take pg off its LRU list.  Also called by kfree().
+void lrudel(struct page *pg){
+  struct lru *l = pg->lru;
+
+  if(pg->next == pg)
+    l->head = 0;
+  else {
+    pg->prev->next = pg->next;
+    pg->next->prev = pg->prev;
+    if(l->head == pg)
+      l->head = pg->next;
   }
-
-
-int getLAP(){
-  int i; 
-  int pageIndex = -1;
-  uint minAccess = 0xffffffff;
-
-  for (i = 0; i < MAX_PYSC_PAGES; i++) {
-    if (proc->ramCtrlr[i].state == USED && proc->ramCtrlr[i].accessCount <= minAccess) {
-          minAccess = proc->ramCtrlr[i].accessCount;
-          pageIndex = i;          
-    }
+  l->n--;
+  if(pg->flags & PG_PINNED){
+    pg->flags &= ~PG_PINNED;
+    l->npinned--;
   }
-  return pageIndex;
+  pg->lru = 0;
+  pg->next = pg->prev = 0;
 }
 
-int getPageOutIndex(){
+//Pick the page to evict from l.  Pinned pages are passed over.
+static struct page* getVictim(struct lru *l){
+  struct page *pg, *victim;
+  pte_t *pte;
+
+  if(l->n <= l->npinned)
+    panic("getVictim: no unpinned pages");
   #if LIFO
-    return getLIFO();
+    for(pg = l->head; pg->flags & PG_PINNED; pg = pg->next)
+      ;
+    return pg;
   #endif
   #if SCFIFO
-    return getSCFIFO();
+    //Oldest page first, but a page accessed since it was last
+    //considered gets a second chance as if it were just loaded.
+    for(;;){
+      pg = l->head->prev;
+      pte = walkpgdir(pg->pgdir, (char*)pg->va, 0);
+      if(!(*pte & PTE_A) && !(pg->flags & PG_PINNED))
+        return pg;
+      *pte &= ~PTE_A; // turn off PTE_A flag
+      tlbinval(pg->pgdir, pg->va); //so the next access sets it again
+      l->head = pg; //the list is circular: the oldest becomes the newest
+    }
   #endif
   #if LAP
-    return getLAP();
+    //Least accessed page, the oldest one on ties.
+    victim = 0;
+    pg = l->head->prev;
+    do {
+      if(!(pg->flags & PG_PINNED) &&
+         (victim == 0 || pg->accessCount < victim->accessCount))
+        victim = pg;
+      pg = pg->prev;
+    } while(pg != l->head->prev);
+    return victim;
   #endif
+  (void)pg; (void)victim; (void)pte; //unused under some policies
   panic("Unrecognized paging machanism");
 }
 
+//Count the pages of p accessed since the last call (LAP).
+//Called from the timer interrupt for the process it interrupted in
+//user mode, so no one else is touching p's lru.
 void updateAccessCounters(struct proc * p){
+  struct page *pg;
   pte_t * pte;
+  struct tlbbatch b;
   int i;
-  for (i = 0; i < MAX_PYSC_PAGES; i++) {
-    if (p->ramCtrlr[i].state == USED){
-      pte = walkpgdir(p->ramCtrlr[i].pgdir, (char*)p->ramCtrlr[i].userPageVAddr,0);
-      if (*pte & PTE_A) {
-        *pte &= ~PTE_A; // turn off PTE_A flag
-         p->ramCtrlr[i].accessCount++;
-      }
-    } 
+  tlbbatchinit(&b, p->pgdir);
+  for (i = 0, pg = p->lru.head; i < p->lru.n; i++, pg = pg->next) {
+    pte = walkpgdir(pg->pgdir, (char*)pg->va, 0);
+    if (*pte & PTE_A) {
+      *pte &= ~PTE_A; // turn off PTE_A flag
+      tlbbatchadd(&b, pg->pgdir, pg->va);
+      pg->accessCount++;
+    }
   }
+  tlbflush(&b);
 }
 
-int getFreeRamCtrlrIndex() {
+//Is the current process at its limit of resident pages?
+int ramIsFull(void) {
   if (proc == 0)
-    return -1;
-  int i;
-  for (i = 0; i < MAX_PYSC_PAGES; i++) {
-    if (proc->ramCtrlr[i].state == NOTUSED)
-      return i;
+    return 1;
+  return proc->lru.n >= MAX_PYSC_PAGES;
+}
+
+//Evict the resident page pg and free its frame.
+//File-backed pages are dropped (see mmapevict), all others go to the swap file.
+static void pageOut(struct page *pg){
+  uint userPageVAddr = pg->va;
+  pde_t *pgdir = pg->pgdir;
+
+  lrudel(pg);
+  if (!mmapevict(pgdir, userPageVAddr)){
+    writePageToFile(proc, userPageVAddr, pgdir, p2v(page2pa(pg)));
+    fixPagedOutPTE(userPageVAddr, pgdir);
+    proc->pgio++;
   }
-  return -1; //NO ROOM IN RAMCTRLR
+  kfree(p2v(page2pa(pg))); //free swapped page
 }
 
 static char buff[PGSIZE]; //buffer used to store swapped page in getPageFromFile method
 
 int getPageFromFile(int cr2){
+  struct page *victim;
+
   proc->faultCounter++;
+  proc->pgio++;
   int userPageVAddr = PGROUNDDOWN(cr2);
-  char * newPg = kalloc();
-  memset(newPg, 0, PGSIZE);
-  int outIndex = getFreeRamCtrlrIndex();
-  lcr3(v2p(proc->pgdir)); //refresh CR3 register
-  if (outIndex >= 0) { //Free location in RamCtrlr is available, no need for swapping
+  char * newPg = kalloc(); //no need to clear it: the whole page is read from the swap file
+  if (!ramIsFull()) { //room for another resident page, no need for swapping
     fixPagedInPTE(userPageVAddr, v2p(newPg), proc->pgdir);
-    readPageFromFile(proc, outIndex, userPageVAddr, (char*)userPageVAddr);
+    readPageFromFile(proc, userPageVAddr, (char*)userPageVAddr);
+    addToLRU(proc->pgdir, userPageVAddr);
     return 1; //Operation was successful
   }
   proc->countOfPagedOut++;
   //If reached here - Swapping is needed.
-  outIndex = getPageOutIndex(); //select a page to swap to file
-  struct pagecontroller outPage = proc->ramCtrlr[outIndex];
+  victim = getVictim(&proc->lru); //select a page to swap to file
   fixPagedInPTE(userPageVAddr, v2p(newPg), proc->pgdir);
-  readPageFromFile(proc, outIndex, userPageVAddr, buff); //automatically adds to ramctrlr
-  int outPagePAddr = getPagePAddr(outPage.userPageVAddr, outPage.pgdir);
+  readPageFromFile(proc, userPageVAddr, buff); //frees its swap slot for the victim
   memmove(newPg, buff, PGSIZE);
-  writePageToFile(proc, outPage.userPageVAddr, outPage.pgdir);
-  fixPagedOutPTE(outPage.userPageVAddr, outPage.pgdir);
-  char *v = p2v(outPagePAddr);
-  kfree(v); //free swapped page
+  pageOut(victim);
+  addToLRU(proc->pgdir, userPageVAddr);
   return 1;
 }
 
-void addToRamCtrlr(pde_t *pgdir, uint userPageVAddr) {
-  int freeLocation = getFreeRamCtrlrIndex();
-  proc->ramCtrlr[freeLocation].state = USED;
-  proc->ramCtrlr[freeLocation].pgdir = pgdir;
-  proc->ramCtrlr[freeLocation].userPageVAddr = userPageVAddr;
-  proc->ramCtrlr[freeLocation].loadOrder = proc->loadOrderCounter++;
-  proc->ramCtrlr[freeLocation].accessCount = 0;
-}
+//Start tracking the resident page userPageVAddr of pgdir.
+void addToLRU(pde_t *pgdir, uint userPageVAddr) {
+  struct page *pg;
+  pte_t *pte;
 
+  pte = walkpgdir(pgdir, (char*)userPageVAddr, 0);
+  if (!pte || !(*pte & PTE_P))
+    panic("addToLRU");
+  pg = pa2page(PTE_ADDR(*pte));
+  rmapset(PTE_ADDR(*pte), pgdir, userPageVAddr);
+  pg->accessCount = 0;
+  lrupush(&proc->lru, pg);
+}
 
+//Make room by evicting a page, then track userPageVAddr.
 void swap(pde_t *pgdir, uint userPageVAddr){
   proc->countOfPagedOut++;
-  int outIndex = getPageOutIndex();
-  int outPagePAddr = getPagePAddr(proc->ramCtrlr[outIndex].userPageVAddr, proc->ramCtrlr[outIndex].pgdir);
-  writePageToFile(proc, proc->ramCtrlr[outIndex].userPageVAddr, proc->ramCtrlr[outIndex].pgdir);
-  char *v = p2v(outPagePAddr);
-  kfree(v); //free swapped page
-  proc->ramCtrlr[outIndex].state = NOTUSED;
-  fixPagedOutPTE(proc->ramCtrlr[outIndex].userPageVAddr, proc->ramCtrlr[outIndex].pgdir);
-  addToRamCtrlr(pgdir, userPageVAddr);
+  pageOut(getVictim(&proc->lru));
+  addToLRU(pgdir, userPageVAddr);
 }
 
+//Evict as much of the current process's resident set as its swap
+//file has room for.  Used when load control suspends it.
+void pageOutAll(void){
+  while (proc->lru.n > proc->lru.npinned && getFreeSlot(proc) >= 0){
+    proc->countOfPagedOut++;
+    pageOut(getVictim(&proc->lru));
+  }
+}
+
+//Move every page of from to the empty list to, keeping their order.
+static void lrumove(struct lru *from, struct lru *to){
+  struct page *pg;
+  int i;
+
+  *to = *from;
+  for (i = 0, pg = to->head; i < to->n; i++, pg = pg->next)
+    pg->lru = to;
+  from->head = 0;
+  from->n = 0;
+  from->npinned = 0;
+}
+
+//Called by exec before it builds the new image: set the old image's
+//resident pages and swap slots aside in s, so that the new image
+//starts with an empty resident set and the whole swap file.  The old
+//image's paged-out pages are read into memory (fileCtrlr[i].mem), so
+//the swap file never holds more than one image.  On success exec
+//frees the old image and calls execdone(); on failure it calls
+//execunstage().  Returns -1, with nothing set aside, if out of memory.
+int execstage(struct pagingsave *s){
+  int i;
+
+  memmove(s->fileCtrlr, proc->fileCtrlr, sizeof(s->fileCtrlr));
+  for (i = 0; i < MAX_TOTAL_PAGES-MAX_PYSC_PAGES; i++){
+    s->fileCtrlr[i].mem = 0;
+    if (s->fileCtrlr[i].state != USED)
+      continue;
+    if ((s->fileCtrlr[i].mem = kalloc()) == 0 ||
+        readFromSwapFile(proc, s->fileCtrlr[i].mem, i*PGSIZE, PGSIZE) != PGSIZE){
+      execdone(s);
+      return -1;
+    }
+  }
+  lrumove(&proc->lru, &s->lru);
+  s->npages = proc->npages;
+  proc->npages = 0;
+  for (i = 0; i < MAX_TOTAL_PAGES-MAX_PYSC_PAGES; i++)
+    proc->fileCtrlr[i].state = NOTUSED;
+  return 0;
+}
+
+//Free the copies of the old image's paged-out pages in s.
+void execdone(struct pagingsave *s){
+  int i;
+
+  for (i = 0; i < MAX_TOTAL_PAGES-MAX_PYSC_PAGES; i++){
+    if (s->fileCtrlr[i].mem)
+      kfree(s->fileCtrlr[i].mem);
+    s->fileCtrlr[i].mem = 0;
+  }
+}
+
+//Exchange the paging state of the current process with s.  exec
+//calls it around munmapall() so that the old image's regions are
+//unmapped with the old image's pages, swap slots and page count.
+void execswap(struct pagingsave *s){
+  struct lru l;
+  struct pagecontroller c;
+  struct page *pg;
+  int i, n;
+
+  l = proc->lru;
+  proc->lru = s->lru;
+  s->lru = l;
+  for (i = 0, pg = proc->lru.head; i < proc->lru.n; i++, pg = pg->next)
+    pg->lru = &proc->lru;
+  for (i = 0, pg = s->lru.head; i < s->lru.n; i++, pg = pg->next)
+    pg->lru = &s->lru;
+  for (i = 0; i < MAX_TOTAL_PAGES-MAX_PYSC_PAGES; i++){
+    c = proc->fileCtrlr[i];
+    proc->fileCtrlr[i] = s->fileCtrlr[i];
+    s->fileCtrlr[i] = c;
+  }
+  n = proc->npages;
+  proc->npages = s->npages;
+  s->npages = n;
+}
+
+//Give the old image back its paging state after a failed exec,
+//writing its paged-out pages back to their swap slots.  The new
+//image must already have been freed, and exec must have ended its
+//transaction, since the writes start their own.
+void execunstage(struct pagingsave *s){
+  int i;
+
+  for (i = 0; i < MAX_TOTAL_PAGES-MAX_PYSC_PAGES; i++)
+    if (s->fileCtrlr[i].mem &&
+        writeToSwapFile(proc, s->fileCtrlr[i].mem, i*PGSIZE, PGSIZE) != PGSIZE)
+      panic("execunstage");
+  execdone(s);
+  lrumove(&s->lru, &proc->lru);
+  proc->npages = s->npages;
+  memmove(proc->fileCtrlr, s->fileCtrlr, sizeof(s->fileCtrlr));
+}
+
+//Give the fork child np the same resident pages, in the same order,
+//as the current process.  np->pgdir must be a copy of proc->pgdir.
+void copyLRU(struct proc *np){
+  struct page *pg, *oldest, *npg;
+  pte_t *pte;
+
+  if (proc->lru.head == 0)
+    return;
+  oldest = proc->lru.head->prev;
+  pg = oldest;
+  do {
+    pte = walkpgdir(np->pgdir, (char*)pg->va, 0);
+    if (pte && (*pte & PTE_P)){
+      npg = pa2page(PTE_ADDR(*pte));
+      rmapset(PTE_ADDR(*pte), np->pgdir, pg->va);
+      npg->accessCount = pg->accessCount;
+      lrupush(&np->lru, npg);
+    }
+    pg = pg->prev;
+  } while (pg != oldest);
+}
+
+
+//Grow the user stack of the current process down to the page holding va,
+//if va lies in the reserve between proc->stackLimit and proc->stackBottom.
+//New pages are tracked by the pager like any other page.
+//Returns 1 if the fault was handled.
+int growstack(uint va){
+  char *mem;
+  uint a;
+
+  if(va < proc->stackLimit || va >= proc->stackBottom)
+    return 0;
+  a = PGROUNDDOWN(va);
+  if (!isNONEpolicy() && proc->pid > 2 &&
+      proc->npages + (proc->stackBottom - a)/PGSIZE > MAX_TOTAL_PAGES){
+    cprintf("proc is too big\n");
+    return 0;
+  }
+  while(proc->stackBottom > a){ //one page at a time, keeping the stack contiguous
+    if((mem = kalloc_zeroed()) == 0)
+      return 0;
+    if(mappages(proc->pgdir, (char*)(proc->stackBottom - PGSIZE), PGSIZE, v2p(mem), PTE_W|PTE_U) < 0){
+      kfree(mem);
+      return 0;
+    }
+    proc->stackBottom -= PGSIZE;
+    proc->npages++;
+    if (!isNONEpolicy() && proc->pid > 2){
+      if (ramIsFull())
+        swap(proc->pgdir, proc->stackBottom);
+      else //there's room
+        addToLRU(proc->pgdir, proc->stackBottom);
+    }
+  }
+  return 1;
+}
+
+//Make the page holding the user address va of the current process
+//present, if it is paged out, in the stack reserve or in a mapped
+//region.  Called for page faults and by uvmprefault.
+//Returns 1 if the page was brought in.
+int uvmfault(uint va){
+  if(va >= KERNBASE)
+    return 0;
+  if(pageIsInFile(va, proc->pgdir))
+    return getPageFromFile(va);
+  return mmapfault(va) || growstack(va);
+}
+
+//Fault in the pages of [va, va+len) the current process has not
+//touched yet or has paged out, and pin the range until the system
+//call returns (see uvmunpin), so that the kernel can use it without
+//faulting: a fault may need file I/O, which must not happen while
+//the system call holds an inode lock or is inside a transaction.
+//The caller has checked that the range belongs to the process.
+//Returns -1 if it does not fit in the resident set beside the pages
+//already pinned, so a buffer may span at most MAX_PYSC_PAGES pages.
+int uvmprefault(uint va, uint len){
+  struct page *pg;
+  pte_t *pte;
+  uint a;
+
+  if(va + len < va)
+    return -1;
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE){
+    if(proc->pgdir[PDX(a)] & PTE_PS)
+      continue; //4MB pages are never paged out
+    pte = walkpgdir(proc->pgdir, (char*)a, 0);
+    if(!pte || !(*pte & PTE_P)){
+      if(ramIsFull() && proc->lru.npinned >= proc->lru.n)
+        return -1; //no page left to evict for it
+      if(!uvmfault(a))
+        return -1;
+      pte = walkpgdir(proc->pgdir, (char*)a, 0);
+    }
+    pg = pa2page(PTE_ADDR(*pte));
+    if(pg->lru == &proc->lru && !(pg->flags & PG_PINNED)){
+      pg->flags |= PG_PINNED;
+      proc->lru.npinned++;
+    }
+  }
+  return 0;
+}
+
+//Unpin the pages uvmprefault pinned.  Called when a system call returns.
+void uvmunpin(void){
+  struct page *pg;
+  int i;
+
+  if(proc->lru.npinned == 0)
+    return;
+  for (i = 0, pg = proc->lru.head; i < proc->lru.n; i++, pg = pg->next)
+    pg->flags &= ~PG_PINNED;
+  proc->lru.npinned = 0;
+}
 
 int isNONEpolicy(){
 	#if NONE
@@ -405,13 +719,13 @@ int isNONEpolicy(){
 int allocuvm(pde_t *pgdir, uint oldsz, uint newsz){
   char *mem;
   uint a;
-  if(newsz >= KERNBASE)
+  if(newsz >= MMAPBASE) //above here belongs to mmap regions
     return 0;
   if(newsz < oldsz)
     return oldsz;
 
   if (!isNONEpolicy()){
-     if (PGROUNDUP(newsz)/PGSIZE > MAX_TOTAL_PAGES && proc->pid > 2) {
+     if (proc->pid > 2 && proc->npages + (PGROUNDUP(newsz) - PGROUNDUP(oldsz))/PGSIZE > MAX_TOTAL_PAGES) {
 		    cprintf("proc is too big\n", PGROUNDUP(newsz)/PGSIZE);
 		    return 0;
 		  }
@@ -420,20 +734,29 @@ int allocuvm(pde_t *pgdir, uint oldsz, uint newsz){
   a = PGROUNDUP(oldsz);
   int i = 0; //debugging
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    //Pages the pager does not track may be backed by a whole 4MB frame
+    if ((isNONEpolicy() || proc->pid <= 2) && a % LARGEPGSIZE == 0 && a + LARGEPGSIZE <= newsz
+        && !(pgdir[PDX(a)] & PTE_P) && (mem = kalloc_large()) != 0){
+      memset(mem, 0, LARGEPGSIZE);
+      pgdir[PDX(a)] = v2p(mem) | PTE_P | PTE_W | PTE_U | PTE_PS;
+      proc->npages += NPTENTRIES;
+      a += LARGEPGSIZE - PGSIZE;
+      continue;
+    }
+    mem = kalloc_zeroed();
     i++;
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     mappages(pgdir, (char*)a, PGSIZE, v2p(mem), PTE_W|PTE_U);
+    proc->npages++;
     if (!isNONEpolicy() && proc->pid > 2){
-      if (PGROUNDUP(oldsz)/PGSIZE + i > MAX_PYSC_PAGES)
+      if (ramIsFull())
         swap(pgdir, a);
       else //there's room
-        addToRamCtrlr(pgdir, a);
+        addToLRU(pgdir, a);
 	  }
   }
   return newsz;
@@ -442,20 +765,6 @@ int allocuvm(pde_t *pgdir, uint oldsz, uint newsz){
 
 //This must use userVaddress+pgdir addresses!
 //(The proc has identical vAddresses on different page directories until exec finish executing)
-void removeFromRamCtrlr(uint userPageVAddr, pde_t *pgdir){
-  if (proc == 0)
-    return;
-  int i;
-  for (i = 0; i < MAX_PYSC_PAGES; i++) {
-    if (proc->ramCtrlr[i].state == USED 
-        && proc->ramCtrlr[i].userPageVAddr == userPageVAddr
-        && proc->ramCtrlr[i].pgdir == pgdir){
-      proc->ramCtrlr[i].state = NOTUSED;
-      return;
-    }
-  }
-}
-
 void removeFromFileCtrlr(uint userPageVAddr, pde_t *pgdir){
   if (proc == 0)
     return;
@@ -465,6 +774,9 @@ void removeFromFileCtrlr(uint userPageVAddr, pde_t *pgdir){
         && proc->fileCtrlr[i].userPageVAddr == userPageVAddr
         && proc->fileCtrlr[i].pgdir == pgdir){
       proc->fileCtrlr[i].state = NOTUSED;
+      if (proc->fileCtrlr[i].mem) //set aside by exec
+        kfree(proc->fileCtrlr[i].mem);
+      proc->fileCtrlr[i].mem = 0;
       return;
     }
   }
@@ -473,17 +785,30 @@ void removeFromFileCtrlr(uint userPageVAddr, pde_t *pgdir){
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
 // process size.  Returns the new process size.
+// Pages of the current process come off proc->npages.
 int deallocuvm(pde_t *pgdir, uint oldsz, uint newsz){
+  pde_t *pde;
   pte_t *pte;
   uint a, pa;
+  int own;
 
   if(newsz >= oldsz)
     return oldsz;
 
+  own = proc && pgdir == proc->pgdir;
   a = PGROUNDUP(newsz);
   int i = 0; //debugging
   for(; a  < oldsz; a += PGSIZE){
-    pte = walkpgdir(pgdir, (char*)a, 0);
+    pde = &pgdir[PDX(a)];
+    if((*pde & PTE_PS) && a % LARGEPGSIZE == 0 && a + LARGEPGSIZE <= oldsz){ //whole 4MB page
+      kfree_large(p2v(PTE_ADDR(*pde)));
+      *pde = 0;
+      if(own)
+        proc->npages -= NPTENTRIES;
+      a += LARGEPGSIZE - PGSIZE;
+      continue;
+    }
+    pte = walkpgdir(pgdir, (char*)a, (*pde & PTE_PS) != 0); //splits a 4MB page that is only partly freed
     if(!pte) //uninitialized page table
       a += (NPTENTRIES - 1) * PGSIZE; //jump to next page table
     else if((*pte & PTE_P) != 0){     //page table exists and page is present
@@ -491,12 +816,17 @@ int deallocuvm(pde_t *pgdir, uint oldsz, uint newsz){
       if(pa == 0)
         panic("kfree");
       char *v = p2v(pa);
-      kfree(v); //free page
-      if (!isNONEpolicy())
-      	removeFromRamCtrlr(a, pgdir);
+      kfree(v); //free page; kfree also takes it off its LRU list
     
       i++;
       *pte = 0;
+      if(own)
+        proc->npages--;
+    } else if(*pte & PTE_PG){         //page is in the swap file
+      removeFromFileCtrlr(a, pgdir);
+      *pte = 0;
+      if(own)
+        proc->npages--;
     }
   }
   return newsz;
@@ -510,8 +840,8 @@ void freevm(pde_t *pgdir){
     panic("freevm: no pgdir");
   deallocuvm(pgdir, KERNBASE, 0);
   int j = 0;
-  for(i = 0; i < NPDENTRIES; i++){
-    if(pgdir[i] & PTE_P){ //PDE exists
+  for(i = 0; i < PDX(KERNBASE); i++){ //kernel page tables are shared
+    if((pgdir[i] & PTE_P) && !(pgdir[i] & PTE_PS)){ //PDE points to a page table
       char * v = p2v(PTE_ADDR(pgdir[i]));
       kfree(v); //free page table
       j++;
@@ -534,8 +864,10 @@ clearpteu(pde_t *pgdir, char *uva)
 }
 
 // Given a parent process's page table, create a copy
-// of it for a child.
-pde_t* copyuvm(pde_t *pgdir, uint sz){
+// of it for a child.  A 4MB page is copied whole only if large is
+// set; a child that the pager tracks gets it as 4KB pages, since
+// the pager can neither evict nor count a 4MB page.
+pde_t* copyuvm(pde_t *pgdir, uint sz, int large){
   pde_t *d;
   pte_t *pte;
   uint pa, i, flags;
@@ -545,17 +877,29 @@ pde_t* copyuvm(pde_t *pgdir, uint sz){
     return 0;
   int j = 0;
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if (*pte & PTE_PG){
-    	fixPagedOutPTE(i, d);
-    	continue;
+    if(large && (pgdir[PDX(i)] & PTE_PS) && i % LARGEPGSIZE == 0 && i + LARGEPGSIZE <= sz
+        && (mem = kalloc_large()) != 0){ //copy a 4MB page whole
+      memmove(mem, p2v(PTE_ADDR(pgdir[PDX(i)])), LARGEPGSIZE);
+      d[PDX(i)] = v2p(mem) | PTE_FLAGS(pgdir[PDX(i)]);
+      i += LARGEPGSIZE - PGSIZE;
+      continue;
     }
+    if(pgdir[PDX(i)] & PTE_PS){ //copy page by page, leaving the parent's 4MB page whole
+      pa = PTE_ADDR(pgdir[PDX(i)]) + i % LARGEPGSIZE;
+      flags = PTE_FLAGS(pgdir[PDX(i)]) & ~PTE_PS;
+    } else {
+      if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0 || *pte == 0)
+        continue; //stack reserve page that was never used
+      if (*pte & PTE_PG){
+      	fixPagedOutPTE(i, d);
+      	continue;
+      }
 
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
-    pa = PTE_ADDR(*pte);
-    flags = PTE_FLAGS(*pte);
+      if(!(*pte & PTE_P))
+        panic("copyuvm: page not present");
+      pa = PTE_ADDR(*pte);
+      flags = PTE_FLAGS(*pte);
+    }
     if((mem = kalloc()) == 0)
       goto bad;
     memmove(mem, (char*)p2v(pa), PGSIZE);
@@ -575,10 +919,17 @@ bad:
 char*
 uva2ka(pde_t *pgdir, char *uva)
 {
+  pde_t *pde;
   pte_t *pte;
 
+  pde = &pgdir[PDX(uva)];
+  if(*pde & PTE_PS){ //4MB page
+    if((uint)uva >= KERNBASE || (*pde & PTE_U) == 0)
+      return 0;
+    return (char*)p2v(PTE_ADDR(*pde)) + (uint)uva % LARGEPGSIZE;
+  }
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;